@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "defs.h"
+#include "camera.h"
+#include "config.h"
+#include "governor.h"
+#include "graphics.h"
+#include "map.h"
+#include "memory.h"
+#include "player.h"
+#include "ray.h"
+#include "shading.h"
+#include "textures.h"
+#include "threadpool.h"
+#include "timer.h"
+#include "upscale.h"
+#include "wall.h"
+
+// Headless benchmark: replays a fixed set of camera poses through the same
+// passes as render() in main.c, into the colorBuffer, without a window or frame cap.
+
+#define DEFAULT_BENCH_FRAMES 200
+#define BENCH_WARMUP_FRAMES 10
+
+typedef struct {
+	const char* name;
+	float x;
+	float y;
+	float rotationAngle;
+} bench_pose_t;
+
+typedef enum {
+	STAGE_CAST,
+	STAGE_CLEAR,
+	STAGE_WALL,
+	STAGE_MINIMAP,
+	STAGE_RESOLVE,
+	STAGE_UPSCALE,
+	NUM_STAGES
+} bench_stage_t;
+
+static const char* stageNames[NUM_STAGES] = {
+	"castAllRays",
+	"clear",
+	"renderWallProjection",
+	"minimap",
+	"resolveColorBuffer",
+	"upscaleNearest",
+};
+
+static const bench_pose_t poses[] = {
+	{ "spawn",        640, 400, PI / 2 },
+	{ "corner-nw",    100, 100, 0 },
+	{ "corner-ne",   1200, 100, PI },
+	{ "south-north",  640, 700, 3 * PI / 2 },
+	{ "corner-sw",    150, 750, PI / 4 },
+	{ "corner-se",   1150, 720, 5 * PI / 4 },
+	{ "pillars",      300, 280, PI / 2 },
+	{ "face-wall",     80, 600, PI },
+};
+
+#define NUM_POSES ((int)(sizeof(poses) / sizeof(poses[0])))
+
+// With --display=WxH each frame is also scaled up to that size, as the window does.
+static int displayWidth = 0;
+static int displayHeight = 0;
+static color_t* displayBuffer = NULL;
+
+static uint64_t hashColorBuffer(void)
+{
+	// FNV-1a over the final frame, to compare output between runs and modes
+	const color_t* buffer = getColorBuffer();
+	uint64_t hash = 1469598103934665603ull;
+	for (int i = 0; i < getRenderWidth() * getRenderHeight(); i++)
+	{
+		hash ^= buffer[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// With --frame-budget the governor resizes the frame as in main.c, so checksums then depend on timing.
+static void governResolution(uint64_t workNs)
+{
+	governor_decision_t decision;
+	if (!updateGovernor(workNs, &decision))
+		return;
+	if (config.governorLog)
+		printGovernorDecision(&decision);
+	setRenderResolution(decision.toWidth, decision.toHeight);
+	setupCamera(decision.toWidth, decision.toHeight, FOV_ANGLE);
+}
+
+static void renderFrame(uint64_t stageNs[NUM_STAGES])
+{
+	uint64_t t0 = getTimeNanoseconds();
+	castAllRays();
+	uint64_t t1 = getTimeNanoseconds();
+	if (config.clearMode == CLEAR_MODE_FULL)
+		clearColorBuffer(0xFF000000);
+	else
+		clearUncoveredColorBuffer(0xFF000000);
+	uint64_t t2 = getTimeNanoseconds();
+	renderWallProjection();
+	uint64_t t3 = getTimeNanoseconds();
+	renderMap();
+	renderPlayer();
+	renderRays();
+	uint64_t t4 = getTimeNanoseconds();
+	resolveColorBuffer();
+	uint64_t t5 = getTimeNanoseconds();
+	if (displayBuffer)
+		upscaleNearest(getColorBuffer(), getRenderWidth(), getRenderHeight(), getRenderWidth(),
+			displayBuffer, displayWidth, displayHeight, displayWidth);
+	uint64_t t6 = getTimeNanoseconds();
+
+	stageNs[STAGE_CAST] += t1 - t0;
+	stageNs[STAGE_CLEAR] += t2 - t1;
+	stageNs[STAGE_WALL] += t3 - t2;
+	stageNs[STAGE_MINIMAP] += t4 - t3;
+	stageNs[STAGE_RESOLVE] += t5 - t4;
+	stageNs[STAGE_UPSCALE] += t6 - t5;
+	governResolution(t4 - t0);
+}
+
+static void printStages(const char* label, const uint64_t stageNs[NUM_STAGES], int frames)
+{
+	uint64_t frameNs = 0;
+	double numPixels = (double)getRenderWidth() * getRenderHeight();
+	for (int s = 0; s < NUM_STAGES; s++)
+	{
+		if (s == STAGE_UPSCALE && !displayBuffer)
+			continue;
+		double nsPerFrame = (double)stageNs[s] / frames;
+		frameNs += stageNs[s];
+		if (s == STAGE_CAST)
+			printf("%-12s %-22s %12.0f %10.2f %10s %10.1f\n",
+				label, stageNames[s], nsPerFrame, nsPerFrame / camera.numColumns, "-", 1e9 / nsPerFrame);
+		else
+			printf("%-12s %-22s %12.0f %10s %10.3f %10.1f\n",
+				label, stageNames[s], nsPerFrame, "-", nsPerFrame / numPixels, 1e9 / nsPerFrame);
+	}
+	double nsPerFrame = (double)frameNs / frames;
+	printf("%-12s %-22s %12.0f %10s %10.3f %10.1f\n",
+		label, "frame", nsPerFrame, "-", nsPerFrame / numPixels, 1e9 / nsPerFrame);
+}
+
+// Busy time of each pool thread across the parallel stages (cast, clear and wall).
+static void printThreadTimings(const thread_timing_t* timings, const uint64_t stageNs[NUM_STAGES], int frames)
+{
+	double parallelNs = (double)(stageNs[STAGE_CAST] + stageNs[STAGE_CLEAR] + stageNs[STAGE_WALL]) / frames;
+	printf("%-12s %-22s %12s %10s %10s\n", "thread", "", "busy ns", "bands", "busy %");
+	for (int t = 0; t < getThreadPoolSize(); t++)
+	{
+		double busyNs = (double)timings[t].busyNs / frames;
+		printf("%-12d %-22s %12.0f %10.1f %10.1f\n",
+			t, "parallel stages", busyNs, (double)timings[t].bands / frames, 100.0 * busyNs / parallelNs);
+	}
+}
+
+static bool setup(void)
+{
+	if (!initializeColorBuffer(config.renderWidth, config.renderHeight, config.framebufferLayout)
+		|| !setupCamera(config.renderWidth, config.renderHeight, FOV_ANGLE) || !initializeRays(config.renderWidth)
+		|| !initializeThreadPool(config.numThreads))
+		return false;
+	if (displayWidth > 0 && displayHeight > 0)
+	{
+		displayBuffer = (color_t*)alignedAlloc(sizeof(color_t) * displayWidth * displayHeight);
+		if (!displayBuffer)
+		{
+			fprintf(stderr, "Error allocating display buffer.\n");
+			return false;
+		}
+	}
+	initializeRayCaster(config.rayCaster);
+	initializeShading(config.fogLevels);
+	loadWallTextures(config.textureLayout, config.mipmaps, config.shadingMode == SHADING_BAKED ? shading.numShades : 1);
+	// the wall pass fills every column below the minimap, which fills its own rectangle
+	if (config.clearMode == CLEAR_MODE_UNCOVERED)
+		setFrameCoverage(config.renderWidth, MINIMAP_WIDTH, MINIMAP_HEIGHT);
+	initializeGovernor(config.frameBudgetMs, config.renderWidth, config.renderHeight);
+	for (int i = 0; i < NUM_TEXTURES; i++)
+	{
+		if (wallTextures[i].numMipLevels == 0)
+		{
+			fprintf(stderr, "Error loading wall textures (run from the raycasting-c directory).\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void releaseResources(void)
+{
+	freeWallTextures();
+	freeMinimapLayer();
+	destroyThreadPool();
+	freeRays();
+	freeCamera();
+	freeColorBuffer();
+	alignedFree(displayBuffer);
+	displayBuffer = NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	int frames = DEFAULT_BENCH_FRAMES;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--frames=", 9) == 0)
+			frames = atoi(argv[i] + 9);
+		else if (strncmp(argv[i], "--display=", 10) == 0)
+		{
+			if (sscanf(argv[i] + 10, "%dx%d", &displayWidth, &displayHeight) != 2)
+				displayWidth = displayHeight = 0;
+		}
+		else if (!parseConfigOption(argv[i]))
+		{
+			fprintf(stderr, "usage: %s [--frames=N] [--display=WIDTHxHEIGHT] [options]\n", argv[0]);
+			printConfigUsage();
+			return (EXIT_FAILURE);
+		}
+	}
+	if (frames <= 0)
+		frames = DEFAULT_BENCH_FRAMES;
+
+	if (!setup())
+	{
+		releaseResources();
+		return (EXIT_FAILURE);
+	}
+
+	printf("%dx%d, %d rays, %d threads, %s ray caster, %s textures, mipmaps %s, %s framebuffer, %s shading, %d fog levels, %s clear, %d frames per pose\n",
+		getRenderWidth(), getRenderHeight(), camera.numColumns, getThreadPoolSize(), getRayCasterName(),
+		textureLayoutNames[config.textureLayout], config.mipmaps ? "on" : "off", framebufferLayoutNames[config.framebufferLayout],
+		shadingModeNames[config.shadingMode], shading.numFogLevels, clearModeNames[config.clearMode], frames);
+	if (displayBuffer)
+		printf("upscaled to %dx%d\n", displayWidth, displayHeight);
+	if (isGovernorEnabled())
+		printf("resolution governed to a %.2f ms frame budget\n", config.frameBudgetMs);
+	printf("%-12s %-22s %12s %10s %10s %10s\n", "pose", "stage", "ns/frame", "ns/ray", "ns/pixel", "frames/s");
+
+	uint64_t totalNs[NUM_STAGES] = { 0 };
+	int numThreads = getThreadPoolSize();
+	thread_timing_t* poseTimings = (thread_timing_t*)calloc(numThreads, sizeof(thread_timing_t));
+	thread_timing_t* totalTimings = (thread_timing_t*)calloc(numThreads, sizeof(thread_timing_t));
+	if (!poseTimings || !totalTimings)
+	{
+		fprintf(stderr, "Error allocating thread timings.\n");
+		free(poseTimings);
+		free(totalTimings);
+		releaseResources();
+		return (EXIT_FAILURE);
+	}
+	for (int p = 0; p < NUM_POSES; p++)
+	{
+		uint64_t stageNs[NUM_STAGES] = { 0 };
+		uint64_t warmupNs[NUM_STAGES] = { 0 };
+
+		player.x = poses[p].x;
+		player.y = poses[p].y;
+		player.rotationAngle = poses[p].rotationAngle;
+
+		for (int f = 0; f < BENCH_WARMUP_FRAMES; f++)
+			renderFrame(warmupNs);
+		resetThreadPoolTimings();
+		for (int f = 0; f < frames; f++)
+			renderFrame(stageNs);
+		getThreadPoolTimings(poseTimings);
+
+		printStages(poses[p].name, stageNs, frames);
+		printf("%-12s %-22s %016llx\n", poses[p].name, "checksum", (unsigned long long)hashColorBuffer());
+		for (int s = 0; s < NUM_STAGES; s++)
+			totalNs[s] += stageNs[s];
+		for (int t = 0; t < numThreads; t++)
+		{
+			totalTimings[t].busyNs += poseTimings[t].busyNs;
+			totalTimings[t].bands += poseTimings[t].bands;
+		}
+	}
+	printStages("all", totalNs, frames * NUM_POSES);
+	printThreadTimings(totalTimings, totalNs, frames * NUM_POSES);
+
+	free(poseTimings);
+	free(totalTimings);
+
+	releaseResources();
+	return (EXIT_SUCCESS);
+}
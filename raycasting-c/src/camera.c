@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "camera.h"
+
+camera_t camera = {
+	.numColumns = 0,
+	.columnAngle = NULL,
+	.columnCos = NULL,
+	.columnSin = NULL,
+};
+
+// Columns the tables have room for; fewer columns reuse them without reallocating.
+static int columnCapacity = 0;
+
+bool setupCamera(int numColumns, int numRows, float fovAngle)
+{
+	camera.numRows = numRows;
+	if (camera.columnAngle && camera.numColumns == numColumns && camera.fovAngle == fovAngle)
+		return true;
+
+	if (numColumns > columnCapacity)
+	{
+		freeCamera();
+		camera.columnAngle = (float*)malloc(sizeof(float) * numColumns);
+		camera.columnCos = (float*)malloc(sizeof(float) * numColumns);
+		camera.columnSin = (float*)malloc(sizeof(float) * numColumns);
+		if (!camera.columnAngle || !camera.columnCos || !camera.columnSin)
+		{
+			fprintf(stderr, "Error allocating camera tables.\n");
+			freeCamera();
+			return false;
+		}
+		columnCapacity = numColumns;
+	}
+
+	camera.numColumns = numColumns;
+	camera.fovAngle = fovAngle;
+	camera.distProjPlane = (numColumns / 2.0f) / tan(fovAngle / 2);
+	camera.wallHeightScale = TILE_SIZE * camera.distProjPlane;
+
+	for (int col = 0; col < numColumns; col++)
+	{
+		camera.columnAngle[col] = atan((col - numColumns / 2) / camera.distProjPlane);
+		camera.columnCos[col] = cos(camera.columnAngle[col]);
+		camera.columnSin[col] = sin(camera.columnAngle[col]);
+	}
+	return true;
+}
+
+void freeCamera()
+{
+	free(camera.columnAngle);
+	free(camera.columnCos);
+	free(camera.columnSin);
+	camera.columnAngle = NULL;
+	camera.columnCos = NULL;
+	camera.columnSin = NULL;
+	camera.numColumns = 0;
+	columnCapacity = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stdbool.h>
+#include "defs.h"
+
+// Per-column projection tables, rebuilt only when the resolution or FOV changes.
+typedef struct {
+	int numColumns;
+	int numRows;
+	float fovAngle;
+	float distProjPlane;
+	float wallHeightScale; // TILE_SIZE * distProjPlane: projected height = wallHeightScale / perpDistance
+	float* columnAngle;    // ray angle relative to the view direction
+	float* columnCos;      // cos(columnAngle), also the fisheye correction factor
+	float* columnSin;      // sin(columnAngle)
+} camera_t;
+
+extern camera_t camera;
+
+bool setupCamera(int numColumns, int numRows, float fovAngle);
+void freeCamera(void);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "defs.h"
+
+const char* const rayCasterNames[NUM_RAY_CASTERS] = { "auto", "scalar", "sse", "avx2" };
+const char* const textureLayoutNames[NUM_TEXTURE_LAYOUTS] = { "column", "row" };
+const char* const framebufferLayoutNames[NUM_FRAMEBUFFER_LAYOUTS] = { "row", "column" };
+const char* const shadingModeNames[NUM_SHADING_MODES] = { "baked", "lut" };
+const char* const clearModeNames[NUM_CLEAR_MODES] = { "uncovered", "full" };
+const char* const presentModeNames[NUM_PRESENT_MODES] = { "lock", "copy" };
+const char* const upscaleModeNames[NUM_UPSCALE_MODES] = { "cpu", "sdl" };
+
+config_t config = {
+	.numThreads = 0,
+	.rayCaster = RAY_CASTER_AUTO,
+	.textureLayout = TEXTURE_LAYOUT_COLUMN,
+	.mipmaps = true,
+	.framebufferLayout = FRAMEBUFFER_LAYOUT_ROW,
+	.shadingMode = SHADING_BAKED,
+	.fogLevels = 1,
+	.clearMode = CLEAR_MODE_UNCOVERED,
+	.presentMode = PRESENT_MODE_LOCK,
+	.pipelineDepth = 1,
+	.renderWidth = DEFAULT_RENDER_WIDTH,
+	.renderHeight = DEFAULT_RENDER_HEIGHT,
+	.upscaleMode = UPSCALE_MODE_CPU,
+	.frameBudgetMs = 0,
+	.governorLog = false,
+	.tickRate = TICK_RATE,
+	.frameRate = FPS,
+	.profile = false,
+	.profileFrames = 1024,
+	.profileCsvPath = NULL,
+	.profileTracePath = NULL,
+};
+
+static bool parseIntOption(const char* option, const char* name, int* value)
+{
+	size_t length = strlen(name);
+	if (strncmp(option, name, length) != 0 || option[length] != '=')
+		return false;
+	*value = atoi(option + length + 1);
+	return true;
+}
+
+static bool parseFloatOption(const char* option, const char* name, float* value)
+{
+	size_t length = strlen(name);
+	if (strncmp(option, name, length) != 0 || option[length] != '=')
+		return false;
+	*value = (float)atof(option + length + 1);
+	return true;
+}
+
+static bool parseStringOption(const char* option, const char* name, const char** value)
+{
+	size_t length = strlen(name);
+	if (strncmp(option, name, length) != 0 || option[length] != '=')
+		return false;
+	*value = option[length + 1] != '\0' ? option + length + 1 : NULL;
+	return true;
+}
+
+static bool parseChoiceOption(const char* option, const char* name, const char* const* choices, int numChoices, int* value)
+{
+	size_t length = strlen(name);
+	if (strncmp(option, name, length) != 0 || option[length] != '=')
+		return false;
+	for (int i = 0; i < numChoices; i++)
+	{
+		if (strcmp(option + length + 1, choices[i]) == 0)
+		{
+			*value = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// "--name=WIDTHxHEIGHT"; a malformed size is rejected like an unknown choice.
+static bool parseSizeOption(const char* option, const char* name, int* width, int* height)
+{
+	size_t length = strlen(name);
+	if (strncmp(option, name, length) != 0 || option[length] != '=')
+		return false;
+	char end;
+	return sscanf(option + length + 1, "%dx%d%c", width, height, &end) == 2;
+}
+
+static bool parseSwitchOption(const char* option, const char* name, bool* value)
+{
+	static const char* const switches[] = { "off", "on" };
+	int choice;
+	if (!parseChoiceOption(option, name, switches, 2, &choice))
+		return false;
+	*value = choice == 1;
+	return true;
+}
+
+// Returns false when the option is not a known "--name=value" flag.
+bool parseConfigOption(const char* option)
+{
+	if (parseIntOption(option, "--threads", &config.numThreads))
+	{
+		if (config.numThreads < 0)
+			config.numThreads = 0;
+		return true;
+	}
+
+	int choice;
+	if (parseChoiceOption(option, "--ray-caster", rayCasterNames, NUM_RAY_CASTERS, &choice))
+	{
+		config.rayCaster = (ray_caster_t)choice;
+		return true;
+	}
+	if (parseChoiceOption(option, "--texture-layout", textureLayoutNames, NUM_TEXTURE_LAYOUTS, &choice))
+	{
+		config.textureLayout = (texture_layout_t)choice;
+		return true;
+	}
+	if (parseSwitchOption(option, "--mipmaps", &config.mipmaps))
+		return true;
+	if (parseChoiceOption(option, "--framebuffer", framebufferLayoutNames, NUM_FRAMEBUFFER_LAYOUTS, &choice))
+	{
+		config.framebufferLayout = (framebuffer_layout_t)choice;
+		return true;
+	}
+	if (parseChoiceOption(option, "--shading", shadingModeNames, NUM_SHADING_MODES, &choice))
+	{
+		config.shadingMode = (shading_mode_t)choice;
+		return true;
+	}
+	if (parseIntOption(option, "--fog", &config.fogLevels))
+	{
+		if (config.fogLevels < 1)
+			config.fogLevels = 1;
+		return true;
+	}
+	if (parseChoiceOption(option, "--clear", clearModeNames, NUM_CLEAR_MODES, &choice))
+	{
+		config.clearMode = (clear_mode_t)choice;
+		return true;
+	}
+	if (parseChoiceOption(option, "--present", presentModeNames, NUM_PRESENT_MODES, &choice))
+	{
+		config.presentMode = (present_mode_t)choice;
+		return true;
+	}
+	if (parseIntOption(option, "--pipeline-depth", &config.pipelineDepth))
+	{
+		if (config.pipelineDepth < 1)
+			config.pipelineDepth = 1;
+		return true;
+	}
+	if (parseSizeOption(option, "--resolution", &config.renderWidth, &config.renderHeight))
+		return config.renderWidth >= MIN_RENDER_WIDTH && config.renderHeight >= 1;
+	if (parseChoiceOption(option, "--upscale", upscaleModeNames, NUM_UPSCALE_MODES, &choice))
+	{
+		config.upscaleMode = (upscale_mode_t)choice;
+		return true;
+	}
+	float budgetMs;
+	if (parseFloatOption(option, "--frame-budget", &budgetMs))
+	{
+		config.frameBudgetMs = budgetMs > 0 ? budgetMs : 0;
+		return true;
+	}
+	if (parseSwitchOption(option, "--governor-log", &config.governorLog))
+		return true;
+	if (parseIntOption(option, "--tick-rate", &config.tickRate))
+	{
+		if (config.tickRate < 1)
+			config.tickRate = TICK_RATE;
+		return true;
+	}
+	if (parseIntOption(option, "--fps", &config.frameRate))
+	{
+		if (config.frameRate < 0)
+			config.frameRate = 0;
+		return true;
+	}
+	if (parseSwitchOption(option, "--profile", &config.profile))
+		return true;
+	if (parseIntOption(option, "--profile-frames", &config.profileFrames))
+	{
+		if (config.profileFrames < 1)
+			config.profileFrames = 1;
+		return true;
+	}
+	// exporting the history implies recording it
+	if (parseStringOption(option, "--profile-csv", &config.profileCsvPath))
+	{
+		config.profile = config.profile || config.profileCsvPath;
+		return true;
+	}
+	if (parseStringOption(option, "--profile-trace", &config.profileTracePath))
+	{
+		config.profile = config.profile || config.profileTracePath;
+		return true;
+	}
+	return false;
+}
+
+void printConfigUsage()
+{
+	fprintf(stderr, "  --threads=N    worker threads for ray casting and drawing (0 = all cores)\n");
+	fprintf(stderr, "  --ray-caster=auto|scalar|sse|avx2\n");
+	fprintf(stderr, "                 ray packet kernel; falls back to scalar when unsupported\n");
+	fprintf(stderr, "  --texture-layout=column|row\n");
+	fprintf(stderr, "                 wall texture storage; column-major keeps strip reads contiguous\n");
+	fprintf(stderr, "  --mipmaps=on|off\n");
+	fprintf(stderr, "                 sample distant walls from downscaled wall textures\n");
+	fprintf(stderr, "  --framebuffer=row|column\n");
+	fprintf(stderr, "                 column renders into a transposed buffer, transposed back on present\n");
+	fprintf(stderr, "  --shading=baked|lut\n");
+	fprintf(stderr, "                 baked keeps pre-shaded texture copies, lut shades each texel through a table\n");
+	fprintf(stderr, "  --fog=N        distance fog levels for walls (1 = no fog, at most 16)\n");
+	fprintf(stderr, "  --clear=uncovered|full\n");
+	fprintf(stderr, "                 uncovered writes each pixel once a frame; full clears the whole frame first\n");
+	fprintf(stderr, "  --present=lock|copy\n");
+	fprintf(stderr, "                 lock draws straight into the locked SDL texture, copy uploads the frame\n");
+	fprintf(stderr, "  --pipeline-depth=N\n");
+	fprintf(stderr, "                 frames in flight (2 or 3 render the next frame on a render thread\n");
+	fprintf(stderr, "                 while the last one is presented, always by copying; 1 = off, at most 4)\n");
+	fprintf(stderr, "  --resolution=WIDTHxHEIGHT\n");
+	fprintf(stderr, "                 internal render resolution, one ray per column (default %dx%d, at least %d wide)\n", DEFAULT_RENDER_WIDTH, DEFAULT_RENDER_HEIGHT, MIN_RENDER_WIDTH);
+	fprintf(stderr, "  --upscale=cpu|sdl\n");
+	fprintf(stderr, "                 scale frames to the display with the nearest-neighbour CPU upscaler or SDL\n");
+	fprintf(stderr, "  --frame-budget=MS\n");
+	fprintf(stderr, "                 lower the render resolution (down to 40%%) while casting and drawing take\n");
+	fprintf(stderr, "                 longer than MS per frame, and raise it again when they fit (0 = off)\n");
+	fprintf(stderr, "  --governor-log=on|off\n");
+	fprintf(stderr, "                 print each resolution change the frame budget makes\n");
+	fprintf(stderr, "  --tick-rate=N\n");
+	fprintf(stderr, "                 fixed simulation steps per second (default %d); frames are drawn between them\n", TICK_RATE);
+	fprintf(stderr, "  --fps=N\n");
+	fprintf(stderr, "                 frame rate cap (default %d, 0 = uncapped)\n", FPS);
+	fprintf(stderr, "  --profile=on|off\n");
+	fprintf(stderr, "                 time each frame stage and print p50/p95/p99 on exit\n");
+	fprintf(stderr, "  --profile-frames=N\n");
+	fprintf(stderr, "                 frames of history the profiler keeps (default 1024)\n");
+	fprintf(stderr, "  --profile-csv=PATH\n");
+	fprintf(stderr, "  --profile-trace=PATH\n");
+	fprintf(stderr, "                 export the profiled frames as CSV or as Chrome trace events (chrome://tracing)\n");
+}
@@ -0,0 +1,86 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+typedef enum {
+	RAY_CASTER_AUTO,
+	RAY_CASTER_SCALAR,
+	RAY_CASTER_SSE,
+	RAY_CASTER_AVX2,
+	NUM_RAY_CASTERS
+} ray_caster_t;
+
+typedef enum {
+	TEXTURE_LAYOUT_COLUMN,
+	TEXTURE_LAYOUT_ROW,
+	NUM_TEXTURE_LAYOUTS
+} texture_layout_t;
+
+typedef enum {
+	FRAMEBUFFER_LAYOUT_ROW,
+	FRAMEBUFFER_LAYOUT_COLUMN,
+	NUM_FRAMEBUFFER_LAYOUTS
+} framebuffer_layout_t;
+
+typedef enum {
+	SHADING_BAKED,
+	SHADING_LUT,
+	NUM_SHADING_MODES
+} shading_mode_t;
+
+typedef enum {
+	CLEAR_MODE_UNCOVERED,
+	CLEAR_MODE_FULL,
+	NUM_CLEAR_MODES
+} clear_mode_t;
+
+typedef enum {
+	PRESENT_MODE_LOCK,
+	PRESENT_MODE_COPY,
+	NUM_PRESENT_MODES
+} present_mode_t;
+
+typedef enum {
+	UPSCALE_MODE_CPU,
+	UPSCALE_MODE_SDL,
+	NUM_UPSCALE_MODES
+} upscale_mode_t;
+
+typedef struct {
+	int numThreads; // 0 uses every online core
+	ray_caster_t rayCaster;
+	texture_layout_t textureLayout;
+	bool mipmaps;
+	framebuffer_layout_t framebufferLayout;
+	shading_mode_t shadingMode;
+	int fogLevels;   // 1 disables distance fog
+	clear_mode_t clearMode;
+	present_mode_t presentMode;
+	int pipelineDepth; // frames in flight; 1 renders and presents in turn on the main thread
+	int renderWidth;   // internal resolution, one ray per column
+	int renderHeight;
+	upscale_mode_t upscaleMode;
+	float frameBudgetMs; // cast + rasterize budget for the resolution governor, 0 = fixed resolution
+	bool governorLog;
+	int tickRate;   // fixed simulation steps per second
+	int frameRate;  // frame rate cap, 0 = uncapped
+	bool profile;       // time the stages of each frame and print percentiles on exit
+	int profileFrames;  // frames of history the profiler keeps
+	const char* profileCsvPath;   // NULL or where to export the history on exit
+	const char* profileTracePath; // NULL or where to export it as Chrome trace events
+} config_t;
+
+extern config_t config;
+extern const char* const rayCasterNames[NUM_RAY_CASTERS];
+extern const char* const textureLayoutNames[NUM_TEXTURE_LAYOUTS];
+extern const char* const framebufferLayoutNames[NUM_FRAMEBUFFER_LAYOUTS];
+extern const char* const shadingModeNames[NUM_SHADING_MODES];
+extern const char* const clearModeNames[NUM_CLEAR_MODES];
+extern const char* const presentModeNames[NUM_PRESENT_MODES];
+extern const char* const upscaleModeNames[NUM_UPSCALE_MODES];
+
+bool parseConfigOption(const char* option);
+void printConfigUsage(void);
+
+#endif
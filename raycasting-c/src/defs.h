@@ -12,17 +12,17 @@
 
 #define MINIMAP_SCALE_FACTOR 0.2
 
-#define WINDOW_WIDTH (1280)
-#define WINDOW_HEIGHT (800)
+// Internal render resolution unless --resolution overrides it; the frame is scaled to the display.
+#define DEFAULT_RENDER_WIDTH (1280)
+#define DEFAULT_RENDER_HEIGHT (800)
+// The camera splits the columns around a centre one, so it needs at least two.
+#define MIN_RENDER_WIDTH (2)
 
 #define FOV_ANGLE (60 * (PI / 180))
 
-#define NUM_RAYS WINDOW_WIDTH
-
-#define DIST_PROJ_PLANE ((WINDOW_WIDTH / 2) / tan(FOV_ANGLE / 2))
-
+// Frame rate cap unless --fps overrides it, and simulation ticks per second unless --tick-rate does.
 #define FPS 50
-#define FRAME_TIME_LENGTH (1000 / FPS)
+#define TICK_RATE 60
 
 typedef uint32_t color_t;
 
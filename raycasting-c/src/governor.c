@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include "defs.h"
+#include "governor.h"
+
+// Keeps the cast + rasterize time of a frame under a budget by stepping the render
+// resolution down quickly when frames run long and back up slowly when there is room.
+static struct {
+	float budgetNs; // 0 disables the governor
+	int maxWidth;
+	int maxHeight;
+	int level;
+	float averageNs;
+	int framesOver;
+	int framesUnder;
+	int upscaleFrames; // doubles each time a raise has to be taken back soon after
+	int lastRaiseFrame;
+	int frame;
+} governor = {
+	.budgetNs = 0,
+};
+
+static float getLevelScale(int level)
+{
+	return 1.0f - 0.1f * level;
+}
+
+static void getLevelSize(int level, int* width, int* height)
+{
+	*width = (int)(governor.maxWidth * getLevelScale(level) + 0.5f);
+	*height = (int)(governor.maxHeight * getLevelScale(level) + 0.5f);
+	*width = *width > MIN_RENDER_WIDTH ? *width : MIN_RENDER_WIDTH;
+	*height = *height > 0 ? *height : 1;
+}
+
+// Frame cost is taken to grow with the pixel count.
+static float getLevelCost(int fromLevel, int toLevel)
+{
+	float ratio = getLevelScale(toLevel) / getLevelScale(fromLevel);
+	return ratio * ratio;
+}
+
+void initializeGovernor(float budgetMs, int maxWidth, int maxHeight)
+{
+	governor.budgetNs = budgetMs > 0 ? budgetMs * 1e6f : 0;
+	governor.maxWidth = maxWidth;
+	governor.maxHeight = maxHeight;
+	governor.level = 0;
+	governor.averageNs = 0;
+	governor.framesOver = 0;
+	governor.framesUnder = 0;
+	governor.upscaleFrames = GOVERNOR_UPSCALE_FRAMES;
+	governor.lastRaiseFrame = 0;
+	governor.frame = 0;
+}
+
+bool isGovernorEnabled()
+{
+	return governor.budgetNs > 0;
+}
+
+// Feeds the work time of the frame just finished; returns true and fills decision
+// when the next frame should render at a different resolution.
+bool updateGovernor(uint64_t workNs, governor_decision_t* decision)
+{
+	if (!isGovernorEnabled())
+		return false;
+
+	governor.frame++;
+	if (governor.averageNs == 0)
+		governor.averageNs = (float)workNs;
+	else
+		governor.averageNs += GOVERNOR_SMOOTHING * ((float)workNs - governor.averageNs);
+
+	bool canDrop = governor.level + 1 < GOVERNOR_NUM_LEVELS;
+	bool canRaise = governor.level > 0;
+	governor.framesOver = canDrop && governor.averageNs > GOVERNOR_HIGH_WATERMARK * governor.budgetNs
+		? governor.framesOver + 1 : 0;
+	governor.framesUnder = canRaise
+		&& governor.averageNs * getLevelCost(governor.level, governor.level - 1) < GOVERNOR_LOW_WATERMARK * governor.budgetNs
+		? governor.framesUnder + 1 : 0;
+
+	int level = governor.level;
+	if (governor.framesOver >= GOVERNOR_DOWNSCALE_FRAMES)
+		level++;
+	else if (governor.framesUnder >= governor.upscaleFrames)
+		level--;
+	else
+		return false;
+
+	if (level < governor.level)
+		governor.lastRaiseFrame = governor.frame;
+	else if (governor.lastRaiseFrame > 0 && governor.frame - governor.lastRaiseFrame < GOVERNOR_UPSCALE_FRAMES
+		&& governor.upscaleFrames < GOVERNOR_MAX_UPSCALE_FRAMES)
+		governor.upscaleFrames *= 2;
+
+	decision->frame = governor.frame;
+	getLevelSize(governor.level, &decision->fromWidth, &decision->fromHeight);
+	getLevelSize(level, &decision->toWidth, &decision->toHeight);
+	decision->averageMs = governor.averageNs / 1e6f;
+	decision->budgetMs = governor.budgetNs / 1e6f;
+	decision->overBudget = level > governor.level;
+
+	// start the new level from the predicted cost, so it is not judged on old frames
+	governor.averageNs *= getLevelCost(governor.level, level);
+	governor.level = level;
+	governor.framesOver = 0;
+	governor.framesUnder = 0;
+	return true;
+}
+
+void printGovernorDecision(const governor_decision_t* decision)
+{
+	fprintf(stderr, "governor: frame %d, %.2f ms average %s a %.2f ms budget, %dx%d -> %dx%d\n",
+		decision->frame, decision->averageMs, decision->overBudget ? "near or over" : "well under", decision->budgetMs,
+		decision->fromWidth, decision->fromHeight, decision->toWidth, decision->toHeight);
+}
@@ -0,0 +1,37 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Resolution steps of 10% per axis, from the full render resolution down to 40%.
+#define GOVERNOR_NUM_LEVELS 7
+// Smoothing of the measured frame work time (weight of the newest frame).
+#define GOVERNOR_SMOOTHING 0.2f
+// Drop a level after this many consecutive frames over GOVERNOR_HIGH_WATERMARK of the budget;
+// raise one after this many frames in which the next level up is predicted under GOVERNOR_LOW_WATERMARK.
+#define GOVERNOR_DOWNSCALE_FRAMES 3
+#define GOVERNOR_UPSCALE_FRAMES 60
+// A raise taken back within GOVERNOR_UPSCALE_FRAMES doubles the wait before the next one, up to this.
+#define GOVERNOR_MAX_UPSCALE_FRAMES 960
+#define GOVERNOR_HIGH_WATERMARK 0.95f
+#define GOVERNOR_LOW_WATERMARK 0.75f
+
+// One resolution change and the measurements behind it.
+typedef struct {
+	int frame;
+	int fromWidth;
+	int fromHeight;
+	int toWidth;
+	int toHeight;
+	float averageMs;   // smoothed cast + rasterize time per frame at the old resolution
+	float budgetMs;
+	bool overBudget;   // false when scaling back up into the headroom
+} governor_decision_t;
+
+void initializeGovernor(float budgetMs, int maxWidth, int maxHeight);
+bool isGovernorEnabled(void);
+bool updateGovernor(uint64_t workNs, governor_decision_t* decision);
+void printGovernorDecision(const governor_decision_t* decision);
+
+#endif
@@ -1,12 +1,202 @@
-
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#ifndef HEADLESS
+#include <SDL2/SDL.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "graphics.h"
+#include "memory.h"
+#include "threadpool.h"
+#include "upscale.h"
+
+// Edge of the square tiles the transpose works through, so that both the source
+// columns and the destination rows of a tile stay in cache.
+#define TRANSPOSE_BLOCK_SIZE 32
+
+// The buffers are allocated for the largest resolution and the frame uses the
+// top-left renderWidth x renderHeight of them.
+static int maxRenderWidth = 0;
+static int maxRenderHeight = 0;
+static int renderWidth = 0;
+static int renderHeight = 0;
+
+// Row-major target of the frame: rowBuffer, or with PRESENT_MODE_LOCK the pixels of the
+// locked streaming texture, whose rows are colorBufferPitch pixels apart.
+static color_t* colorBuffer = NULL;
+static int colorBufferPitch = 0;
+static color_t* rowBuffer = NULL;
+// With FRAMEBUFFER_LAYOUT_COLUMN every pass draws into this column-major buffer
+// (pixel (x, y) at x * renderHeight + y) and resolveColorBuffer() transposes it into colorBuffer.
+static color_t* columnBuffer = NULL;
+
+// Pixels that the passes of every frame write anyway: the first coveredColumns columns
+// (the wall pass) and a top-left overlay rectangle (the minimap), which the wall pass skips.
+static struct {
+	int coveredColumns;
+	int overlayWidth;
+	int overlayHeight;
+} coverage = { 0, 0, 0 };
+
+static bool allocateRowBuffer(void)
+{
+	rowBuffer = (color_t*)alignedAlloc(sizeof(color_t) * maxRenderWidth * maxRenderHeight);
+	if (!rowBuffer)
+	{
+		fprintf(stderr, "Error allocating color buffer.\n");
+		return (false);
+	}
+	colorBuffer = rowBuffer;
+	colorBufferPitch = renderWidth;
+	return (true);
+}
+
+static bool allocateColorBuffers(int width, int height, framebuffer_layout_t layout, bool ownRowBuffer)
+{
+	maxRenderWidth = renderWidth = width;
+	maxRenderHeight = renderHeight = height;
+	if (layout == FRAMEBUFFER_LAYOUT_COLUMN)
+	{
+		columnBuffer = (color_t*)alignedAlloc(sizeof(color_t) * width * height);
+		if (!columnBuffer)
+		{
+			fprintf(stderr, "Error allocating color buffer.\n");
+			return (false);
+		}
+	}
+	if (ownRowBuffer && !allocateRowBuffer())
+	{
+		freeColorBuffer();
+		return (false);
+	}
+	return (true);
+}
+
+bool initializeColorBuffer(int width, int height, framebuffer_layout_t layout)
+{
+	return allocateColorBuffers(width, height, layout, true);
+}
+
+void freeColorBuffer()
+{
+	alignedFree(rowBuffer);
+	alignedFree(columnBuffer);
+	rowBuffer = NULL;
+	colorBuffer = NULL;
+	columnBuffer = NULL;
+}
+
+// Renders the following frames at width x height, within the size the buffers were allocated for.
+bool setRenderResolution(int width, int height)
+{
+	if (width < 1 || height < 1 || width > maxRenderWidth || height > maxRenderHeight)
+		return (false);
+	renderWidth = width;
+	renderHeight = height;
+	if (colorBuffer == rowBuffer)
+		colorBufferPitch = renderWidth;
+	return (true);
+}
+
+int getRenderWidth()
+{
+	return renderWidth;
+}
+
+int getRenderHeight()
+{
+	return renderHeight;
+}
+
+// Row-major pixels of the last resolved frame, when the frame is not presented by locking.
+const color_t* getColorBuffer()
+{
+	return colorBuffer;
+}
+
+// Makes the passes draw (or resolve) the frame into caller-owned row-major pixels,
+// such as a slot of the frame pipeline.
+void setColorBufferTarget(color_t* pixels, int pitch)
+{
+	colorBuffer = pixels;
+	colorBufferPitch = pitch;
+}
+
+// Pixels of column x from top to bottom are column[0], column[stride], column[2 * stride], ...
+color_t* getFramebufferColumn(int x, int* stride)
+{
+	if (columnBuffer)
+	{
+		*stride = 1;
+		return columnBuffer + x * renderHeight;
+	}
+	*stride = colorBufferPitch;
+	return colorBuffer + x;
+}
+
+static void transposeBlock(int x0, int y0, int x1, int y1)
+{
+	int x = x0;
+#ifdef __SSE2__
+	// 4x4 tiles: four column segments in, four row segments out.
+	for (; x + 4 <= x1; x += 4)
+	{
+		int y = y0;
+		for (; y + 4 <= y1; y += 4)
+		{
+			const color_t* src = columnBuffer + x * renderHeight + y;
+			__m128 c0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(src)));
+			__m128 c1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(src + renderHeight)));
+			__m128 c2 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(src + 2 * renderHeight)));
+			__m128 c3 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(src + 3 * renderHeight)));
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			color_t* dst = colorBuffer + y * colorBufferPitch + x;
+			_mm_storeu_si128((__m128i*)(dst), _mm_castps_si128(c0));
+			_mm_storeu_si128((__m128i*)(dst + colorBufferPitch), _mm_castps_si128(c1));
+			_mm_storeu_si128((__m128i*)(dst + 2 * colorBufferPitch), _mm_castps_si128(c2));
+			_mm_storeu_si128((__m128i*)(dst + 3 * colorBufferPitch), _mm_castps_si128(c3));
+		}
+		for (; y < y1; y++)
+			for (int i = 0; i < 4; i++)
+				colorBuffer[y * colorBufferPitch + x + i] = columnBuffer[(x + i) * renderHeight + y];
+	}
+#endif
+	for (; x < x1; x++)
+		for (int y = y0; y < y1; y++)
+			colorBuffer[y * colorBufferPitch + x] = columnBuffer[x * renderHeight + y];
+}
+
+// Brings colorBuffer up to date; a no-op unless the passes render column-major.
+void resolveColorBuffer()
+{
+	if (!columnBuffer)
+		return;
+	for (int y0 = 0; y0 < renderHeight; y0 += TRANSPOSE_BLOCK_SIZE)
+	{
+		int y1 = y0 + TRANSPOSE_BLOCK_SIZE < renderHeight ? y0 + TRANSPOSE_BLOCK_SIZE : renderHeight;
+		for (int x0 = 0; x0 < renderWidth; x0 += TRANSPOSE_BLOCK_SIZE)
+		{
+			int x1 = x0 + TRANSPOSE_BLOCK_SIZE < renderWidth ? x0 + TRANSPOSE_BLOCK_SIZE : renderWidth;
+			transposeBlock(x0, y0, x1, y1);
+		}
+	}
+}
 
+#ifndef HEADLESS
 static SDL_Window* window = NULL;
 static SDL_Renderer* renderer = NULL;
-static color_t* colorBuffer = NULL;
 static SDL_Texture* colorBufferTexture;
+static present_mode_t presentMode = PRESENT_MODE_COPY;
+static upscale_mode_t upscaleMode = UPSCALE_MODE_CPU;
+static bool colorBufferLocked = false;
+// Size of colorBufferTexture: the display with the CPU upscaler, the largest frame otherwise.
+static int textureWidth = 0;
+static int textureHeight = 0;
 
-bool initializeWindow()
+bool initializeWindow(int width, int height, framebuffer_layout_t layout, present_mode_t mode, upscale_mode_t upscale)
 {
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
 	{
@@ -15,8 +205,6 @@ bool initializeWindow()
 	}
 	SDL_DisplayMode display_mode;
 	SDL_GetCurrentDisplayMode(0, &display_mode);
-	int fullScreenWidth = display_mode.w;
-	int fullScreenheight = display_mode.h;
 
 	window = SDL_CreateWindow(
 		NULL,
@@ -38,75 +226,297 @@ bool initializeWindow()
 		return (false);
 	}
 	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-	colorBuffer = (color_t*)malloc(sizeof(color_t) * WINDOW_WIDTH * WINDOW_HEIGHT);
+
+	presentMode = mode;
+	upscaleMode = upscale;
+	textureWidth = upscaleMode == UPSCALE_MODE_CPU ? display_mode.w : width;
+	textureHeight = upscaleMode == UPSCALE_MODE_CPU ? display_mode.h : height;
+	// locking draws straight into the texture, so no row-major buffer of our own is needed
+	// unless the CPU upscaler needs a smaller source frame; lockColorBuffer() allocates it then
+	if (!allocateColorBuffers(width, height, layout, presentMode == PRESENT_MODE_COPY))
+		return (false);
 
 	// create an SDL_Texture to display the colorbuffer
 	colorBufferTexture = SDL_CreateTexture(
 		renderer,
 		SDL_PIXELFORMAT_RGBA32,
 		SDL_TEXTUREACCESS_STREAMING,
-		WINDOW_WIDTH,
-		WINDOW_HEIGHT
+		textureWidth,
+		textureHeight
 	);
+	if (!colorBufferTexture)
+	{
+		fprintf(stderr, "Error creating color buffer texture: %s\n", SDL_GetError());
+		return (false);
+	}
 	return (true);
 }
 
 void destroyWindow()
 {
-	free(colorBuffer);
+	if (colorBufferLocked)
+		SDL_UnlockTexture(colorBufferTexture);
+	colorBufferLocked = false;
+	freeColorBuffer();
 	SDL_DestroyTexture(colorBufferTexture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
 
-void clearColorBuffer(color_t color)
+// Points colorBuffer at the streaming texture's pixels for this frame; call before drawing.
+// That works when the frame fills the texture or SDL scales it; the CPU upscaler needs the
+// frame in a buffer of our own, as does a texture that cannot be locked.
+bool lockColorBuffer()
 {
-	for (int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++)
-		colorBuffer[i] = color;
+	if (colorBufferLocked)
+		return (true);
+
+	bool direct = upscaleMode == UPSCALE_MODE_SDL || (renderWidth == textureWidth && renderHeight == textureHeight);
+	if (presentMode == PRESENT_MODE_LOCK && direct)
+	{
+		void* pixels;
+		int pitch;
+		if (SDL_LockTexture(colorBufferTexture, NULL, &pixels, &pitch) == 0 && pitch % sizeof(color_t) == 0)
+		{
+			colorBuffer = (color_t*)pixels;
+			colorBufferPitch = pitch / sizeof(color_t);
+			colorBufferLocked = true;
+			return (true);
+		}
+		fprintf(stderr, "Error locking color buffer texture, copying frames instead: %s\n", SDL_GetError());
+		presentMode = PRESENT_MODE_COPY;
+	}
+	if (!rowBuffer)
+		return allocateRowBuffer();
+	colorBuffer = rowBuffer;
+	colorBufferPitch = renderWidth;
+	return (true);
 }
 
-void renderColorBuffer()
+static void presentTexture(int width, int height)
 {
-	SDL_UpdateTexture(
-		colorBufferTexture,
-		NULL,
-		colorBuffer,
-		(int)((color_t)WINDOW_WIDTH * sizeof(color_t))
-		);
-	SDL_RenderCopy(renderer, colorBufferTexture, NULL, NULL);
+	SDL_Rect frameRect = { 0, 0, width, height };
+	SDL_RenderCopy(renderer, colorBufferTexture, upscaleMode == UPSCALE_MODE_SDL ? &frameRect : NULL, NULL);
 	SDL_RenderPresent(renderer);
 }
 
+void renderColorBuffer()
+{
+	resolveColorBuffer();
+	if (colorBufferLocked)
+	{
+		SDL_UnlockTexture(colorBufferTexture);
+		colorBufferLocked = false;
+		colorBuffer = NULL;
+		presentTexture(renderWidth, renderHeight);
+	}
+	else
+		presentColorBuffer(colorBuffer, renderWidth, renderHeight, colorBufferPitch);
+}
+
+// Uploads and presents a finished width x height frame, scaling it to the display on the
+// CPU when the texture is display-sized. The size is passed in because a pipelined frame
+// may have been rendered before the latest resolution change.
+void presentColorBuffer(const color_t* pixels, int width, int height, int pitch)
+{
+	if (upscaleMode == UPSCALE_MODE_CPU && (width != textureWidth || height != textureHeight))
+	{
+		void* texturePixels;
+		int texturePitch;
+		if (SDL_LockTexture(colorBufferTexture, NULL, &texturePixels, &texturePitch) != 0)
+		{
+			fprintf(stderr, "Error locking color buffer texture: %s\n", SDL_GetError());
+			return;
+		}
+		upscaleNearest(pixels, width, height, pitch,
+			(color_t*)texturePixels, textureWidth, textureHeight, texturePitch / sizeof(color_t));
+		SDL_UnlockTexture(colorBufferTexture);
+	}
+	else
+	{
+		SDL_Rect frameRect = { 0, 0, width, height };
+		SDL_UpdateTexture(colorBufferTexture, &frameRect, pixels, (int)(pitch * sizeof(color_t)));
+	}
+	presentTexture(width, height);
+}
+#endif
+
+typedef struct {
+	color_t* buffer;
+	int lineLength;
+	int lineStride;
+	color_t color;
+} clear_job_t;
+
+// Sets count consecutive pixels; the span fill behind clears and rectangles.
+static void fillSpan(color_t* pixels, int count, color_t color)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i colors = _mm_set1_epi32((int)color);
+	for (; i < count && ((uintptr_t)(pixels + i) & 15) != 0; i++)
+		pixels[i] = color;
+	for (; i + 16 <= count; i += 16)
+	{
+		_mm_store_si128((__m128i*)(pixels + i), colors);
+		_mm_store_si128((__m128i*)(pixels + i + 4), colors);
+		_mm_store_si128((__m128i*)(pixels + i + 8), colors);
+		_mm_store_si128((__m128i*)(pixels + i + 12), colors);
+	}
+	for (; i + 4 <= count; i += 4)
+		_mm_store_si128((__m128i*)(pixels + i), colors);
+#endif
+	for (; i < count; i++)
+		pixels[i] = color;
+}
+
+static void clearLines(void* context, int begin, int end)
+{
+	const clear_job_t* clear = (const clear_job_t*)context;
+	for (int line = begin; line < end; line++)
+		fillSpan(clear->buffer + line * clear->lineStride, clear->lineLength, clear->color);
+}
+
+// Cleared in bands of whole rows (or columns, for the column-major buffer) on the thread pool.
+void clearColorBuffer(color_t color)
+{
+	clear_job_t clear;
+	clear.buffer = columnBuffer ? columnBuffer : colorBuffer;
+	clear.lineLength = columnBuffer ? renderHeight : renderWidth;
+	clear.lineStride = columnBuffer ? renderHeight : colorBufferPitch;
+	clear.color = color;
+	parallelFor(columnBuffer ? renderWidth : renderHeight, clearLines, &clear);
+}
+
+void setFrameCoverage(int coveredColumns, int overlayWidth, int overlayHeight)
+{
+	coverage.coveredColumns = coveredColumns;
+	coverage.overlayWidth = overlayWidth;
+	coverage.overlayHeight = overlayHeight;
+}
+
+// Rows [0, getOverlayBottom(x)) of column x are left to the overlay.
+int getOverlayBottom(int x)
+{
+	if (x >= coverage.overlayWidth)
+		return 0;
+	return coverage.overlayHeight < renderHeight ? coverage.overlayHeight : renderHeight;
+}
+
+// Replaces clearColorBuffer() when every frame draws the covered area in full:
+// only the columns no pass writes are cleared, so each pixel is stored once per frame.
+void clearUncoveredColorBuffer(color_t color)
+{
+	int x0 = coverage.coveredColumns;
+	if (x0 >= renderWidth)
+		return;
+	if (columnBuffer)
+	{
+		fillSpan(columnBuffer + x0 * renderHeight, (renderWidth - x0) * renderHeight, color);
+		return;
+	}
+	for (int y = 0; y < renderHeight; y++)
+		fillSpan(colorBuffer + y * colorBufferPitch + x0, renderWidth - x0, color);
+}
+
+// Clipped to the frame, since the minimap does not shrink with the render resolution.
 void drawPixel(int x, int y, color_t color)
 {
-	colorBuffer[(WINDOW_WIDTH * y) + x] = color;
+	if (x < 0 || x >= renderWidth || y < 0 || y >= renderHeight)
+		return;
+	if (columnBuffer)
+		columnBuffer[(renderHeight * x) + y] = color;
+	else
+		colorBuffer[(colorBufferPitch * y) + x] = color;
 }
 
+// Clipped to the render size; filled a span per line of the framebuffer layout.
 void drawRect(int x, int y, int width, int height, color_t color)
 {
-	for(int i = x; i < x + width; i++)
-		for(int j = y; j < y + height; j++)
-			drawPixel(i, j, color);
+	int x0 = x < 0 ? 0 : x;
+	int y0 = y < 0 ? 0 : y;
+	int x1 = x + width < renderWidth ? x + width : renderWidth;
+	int y1 = y + height < renderHeight ? y + height : renderHeight;
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	if (columnBuffer)
+	{
+		for (int i = x0; i < x1; i++)
+			fillSpan(columnBuffer + (renderHeight * i) + y0, y1 - y0, color);
+		return;
+	}
+	for (int j = y0; j < y1; j++)
+		fillSpan(colorBuffer + (colorBufferPitch * j) + x0, x1 - x0, color);
 }
 
+// Integer Bresenham from (x0, y0) up to, but not including, (x1, y1); the minor axis
+// is rounded half away from zero, and pixels outside the render size are skipped.
 void drawLine(int x0, int y0, int x1, int y1, color_t color)
 {
-	int deltaX = (x1 - x0);
-	int deltaY = (y1 - y0);
+	if ((x0 < 0 && x1 < 0) || (y0 < 0 && y1 < 0)
+		|| (x0 >= renderWidth && x1 >= renderWidth) || (y0 >= renderHeight && y1 >= renderHeight))
+		return;
 
-	int longestSideLength = (abs(deltaX) >= abs(deltaY) ? abs(deltaX) : abs(deltaY));
+	int deltaX = abs(x1 - x0);
+	int deltaY = abs(y1 - y0);
+	int stepX = x1 >= x0 ? 1 : -1;
+	int stepY = y1 >= y0 ? 1 : -1;
+	bool steep = deltaY > deltaX;
+	int length = steep ? deltaY : deltaX;
+	int minorDelta = steep ? deltaX : deltaY;
 
-	float xincrement = deltaX / (float)longestSideLength;
-	float yincrement = deltaY / (float)longestSideLength;
+	// error is (2 * i * minorDelta + length) mod 2 * length, the remainder of the rounding
+	int error = length;
+	int x = x0;
+	int y = y0;
+	for (int i = 0; i < length; i++)
+	{
+		if (x >= 0 && x < renderWidth && y >= 0 && y < renderHeight)
+		{
+			if (columnBuffer)
+				columnBuffer[(renderHeight * x) + y] = color;
+			else
+				colorBuffer[(colorBufferPitch * y) + x] = color;
+		}
+		error += 2 * minorDelta;
+		if (error >= 2 * length)
+		{
+			error -= 2 * length;
+			if (steep)
+				x += stepX;
+			else
+				y += stepY;
+		}
+		if (steep)
+			y += stepY;
+		else
+			x += stepX;
+	}
+}
 
-	float currentX = x0;
-	float currentY = y0;
+// Copies a row-major image (pitch in pixels) opaquely, clipped to the render size.
+void drawImage(int x, int y, int width, int height, const color_t* pixels, int pitch)
+{
+	int x0 = x < 0 ? 0 : x;
+	int y0 = y < 0 ? 0 : y;
+	int x1 = x + width < renderWidth ? x + width : renderWidth;
+	int y1 = y + height < renderHeight ? y + height : renderHeight;
+	if (x0 >= x1 || y0 >= y1)
+		return;
 
-	for (int i = 0; i < longestSideLength; i++)
+	if (columnBuffer)
 	{
-		drawPixel(round(currentX), round(currentY), color);
-		currentX += xincrement;
-		currentY += yincrement;
+		for (int i = x0; i < x1; i++)
+		{
+			const color_t* source = &pixels[(y0 - y) * pitch + (i - x)];
+			color_t* column = &columnBuffer[(renderHeight * i) + y0];
+			for (int j = 0; j < y1 - y0; j++)
+				column[j] = source[j * pitch];
+		}
+		return;
 	}
-}
\ No newline at end of file
+	for (int j = y0; j < y1; j++)
+		memcpy(&colorBuffer[(colorBufferPitch * j) + x0], &pixels[(j - y) * pitch + (x0 - x)], sizeof(color_t) * (x1 - x0));
+}
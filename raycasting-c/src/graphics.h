@@ -2,15 +2,30 @@
 #define GRAPHICS_H
 
 #include <stdbool.h>
-#include <SDL2/SDL.h>
 #include "defs.h"
+#include "config.h"
 
-bool initializeWindow(void);
+bool initializeWindow(int width, int height, framebuffer_layout_t layout, present_mode_t mode, upscale_mode_t upscale);
 void destroyWindow(void);
+bool initializeColorBuffer(int width, int height, framebuffer_layout_t layout);
+void freeColorBuffer(void);
+bool setRenderResolution(int width, int height);
+int getRenderWidth(void);
+int getRenderHeight(void);
+const color_t* getColorBuffer(void);
+void setColorBufferTarget(color_t* pixels, int pitch);
+color_t* getFramebufferColumn(int x, int* stride);
+void resolveColorBuffer(void);
 void clearColorBuffer(color_t color);
+void setFrameCoverage(int coveredColumns, int overlayWidth, int overlayHeight);
+int getOverlayBottom(int x);
+void clearUncoveredColorBuffer(color_t color);
+bool lockColorBuffer(void);
 void renderColorBuffer(void);
+void presentColorBuffer(const color_t* pixels, int width, int height, int pitch);
 void drawPixel(int x, int y, color_t color);
 void drawRect(int x, int y, int width, int height, color_t color);
 void drawLine(int x0, int y0, int x1, int y1, color_t color);
+void drawImage(int x, int y, int width, int height, const color_t* pixels, int pitch);
 
 #endif
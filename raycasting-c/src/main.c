@@ -3,22 +3,57 @@
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 #include "defs.h"
+#include "camera.h"
+#include "config.h"
 #include "textures.h"
 #include "graphics.h"
+#include "governor.h"
 #include "map.h"
+#include "pipeline.h"
 #include "player.h"
+#include "profiler.h"
 #include "ray.h"
+#include "scheduler.h"
+#include "shading.h"
 #include "textures.h"
+#include "threadpool.h"
+#include "timer.h"
 #include "wall.h"
 
 bool isGameRunning = false;
-float ticksLastFrame = 0;
+// Player state at the last two simulation ticks; player is drawn between them.
+player_t previousTick;
+player_t currentTick;
+// Keyboard state, copied into the simulated player at the start of each frame's update().
+frame_input_t input = { 0, 0 };
+// Start of the cast and draw work of the current frame, for the resolution governor.
+uint64_t frameWorkStart = 0;
 
 color_t* wallTexture = NULL;
 color_t* textures[NUM_TEXTURES];
 
-void setup() {
-	loadWallTextures();
+// SDL's high-resolution counter in nanoseconds, without overflowing the multiplication.
+uint64_t getPerformanceNanoseconds()
+{
+	static uint64_t frequency = 0;
+	if (frequency == 0)
+		frequency = SDL_GetPerformanceFrequency();
+	uint64_t counter = SDL_GetPerformanceCounter();
+	return counter / frequency * 1000000000ull + counter % frequency * 1000000000ull / frequency;
+}
+
+bool setup() {
+	initializeRayCaster(config.rayCaster);
+	initializeShading(config.fogLevels);
+	loadWallTextures(config.textureLayout, config.mipmaps, config.shadingMode == SHADING_BAKED ? shading.numShades : 1);
+	// the wall pass fills every column below the minimap, which fills its own rectangle
+	if (config.clearMode == CLEAR_MODE_UNCOVERED)
+		setFrameCoverage(config.renderWidth, MINIMAP_WIDTH, MINIMAP_HEIGHT);
+	initializeGovernor(config.frameBudgetMs, config.renderWidth, config.renderHeight);
+	previousTick = currentTick = player;
+	initializeScheduler(config.tickRate, config.frameRate, getPerformanceNanoseconds());
+	return setupCamera(config.renderWidth, config.renderHeight, FOV_ANGLE) && initializeRays(config.renderWidth)
+		&& initializeThreadPool(config.numThreads);
 }
 
 void processInput()
@@ -34,76 +69,192 @@ void processInput()
 			if (event.key.keysym.sym == SDLK_ESCAPE)
 				isGameRunning = false;
 			if (event.key.keysym.sym == SDLK_UP)
-				player.walkDirection = 1;
+				input.walkDirection = 1;
 			if (event.key.keysym.sym == SDLK_DOWN)
-				player.walkDirection = -1;
+				input.walkDirection = -1;
 			if (event.key.keysym.sym == SDLK_RIGHT)
-				player.turnDirection = 1;
+				input.turnDirection = 1;
 			if (event.key.keysym.sym == SDLK_LEFT)
-				player.turnDirection = -1;
+				input.turnDirection = -1;
 			break;
 		case SDL_KEYUP:
 			if (event.key.keysym.sym == SDLK_UP)
-				player.walkDirection = 0;
+				input.walkDirection = 0;
 			if (event.key.keysym.sym == SDLK_DOWN)
-				player.walkDirection = 0;
+				input.walkDirection = 0;
 			if (event.key.keysym.sym == SDLK_RIGHT)
-				player.turnDirection = 0;
+				input.turnDirection = 0;
 			if (event.key.keysym.sym == SDLK_LEFT)
-				player.turnDirection = 0;
+				input.turnDirection = 0;
 			break;
 	}
 }
 
-void update()
+// SDL_Delay() sleeps whole milliseconds and may oversleep, so it only covers the
+// wait up to the last couple of them and the rest is spun on the counter.
+void waitForFrame()
 {
-	//Compute how long we have until the reach the target frame time in milliseconds
-	int timeToWait = FRAME_TIME_LENGTH - (SDL_GetTicks() - ticksLastFrame);
-
-	// Only delay execution if we are running too fast
-	if (timeToWait > 0 && timeToWait <= FRAME_TIME_LENGTH){
-		SDL_Delay(timeToWait);
+	uint64_t waitNs;
+	while ((waitNs = getFrameWaitNs(getPerformanceNanoseconds())) > 0)
+	{
+		if (waitNs > 2000000)
+			SDL_Delay((uint32_t)((waitNs - 2000000) / 1000000));
 	}
+}
 
-	float deltaTime = (SDL_GetTicks() - ticksLastFrame) / 1000.0f;
-
-	ticksLastFrame = SDL_GetTicks();
+void update(const frame_input_t* frameInput)
+{
+	waitForFrame();
+	float alpha;
+	int ticks = advanceScheduler(getPerformanceNanoseconds(), &alpha);
 
-	movePlayer(deltaTime);
+	frameWorkStart = getTimeNanoseconds();
+	uint64_t stageStart = beginProfileStage();
+	currentTick.walkDirection = frameInput->walkDirection;
+	currentTick.turnDirection = frameInput->turnDirection;
+	for (int i = 0; i < ticks; i++)
+	{
+		previousTick = currentTick;
+		movePlayer(&currentTick, getTickSeconds());
+	}
+	interpolatePlayer(&player, &previousTick, &currentTick, alpha);
+	endProfileStage(PROFILE_MOVE, stageStart);
 
+	stageStart = beginProfileStage();
 	castAllRays();
+	endProfileStage(PROFILE_CAST, stageStart);
 }
 
-void render()
+void renderPasses()
 {
-	clearColorBuffer(0xFF000000);
+	uint64_t stageStart = beginProfileStage();
+	if (config.clearMode == CLEAR_MODE_FULL)
+		clearColorBuffer(0xFF000000);
+	else
+		clearUncoveredColorBuffer(0xFF000000);
+	endProfileStage(PROFILE_CLEAR, stageStart);
 
+	stageStart = beginProfileStage();
 	renderWallProjection();
+	endProfileStage(PROFILE_WALL, stageStart);
 
+	stageStart = beginProfileStage();
 	renderMap();
 	renderPlayer();
 	renderRays();
+	endProfileStage(PROFILE_MINIMAP, stageStart);
+}
 
+// Applies the governor's verdict on the frame just drawn to the frames after it;
+// the ray buffer has room for the full resolution, so only the camera tables change.
+void governResolution(uint64_t workNs)
+{
+	governor_decision_t decision;
+	if (!updateGovernor(workNs, &decision))
+		return;
+	if (config.governorLog)
+		printGovernorDecision(&decision);
+	setRenderResolution(decision.toWidth, decision.toHeight);
+	setupCamera(decision.toWidth, decision.toHeight, FOV_ANGLE);
+}
+
+void render()
+{
+	// with --present=lock the passes below draw straight into the SDL texture
+	if (!lockColorBuffer())
+	{
+		isGameRunning = false;
+		return;
+	}
+	renderPasses();
+	uint64_t workNs = getTimeNanoseconds() - frameWorkStart;
+	uint64_t stageStart = beginProfileStage();
 	renderColorBuffer();
+	endProfileStage(PROFILE_PRESENT, stageStart);
+	governResolution(workNs);
+}
+
+// Render thread side of the frame pipeline; presenting stays on the main thread with SDL.
+void renderPipelinedFrame(const frame_input_t* frameInput)
+{
+	update(frameInput);
+	renderPasses();
+	uint64_t workNs = getTimeNanoseconds() - frameWorkStart;
+	resolveColorBuffer();
+	governResolution(workNs);
 }
 
 void releaseResources(void)
 {
+	destroyThreadPool();
+	freeRays();
+	freeCamera();
 	freeWallTextures();
+	freeMinimapLayer();
+	freeProfiler();
 	destroyWindow();
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
-	isGameRunning = initializeWindow();
-	setup();
+	for (int i = 1; i < argc; i++)
+	{
+		if (!parseConfigOption(argv[i]))
+		{
+			fprintf(stderr, "usage: %s [options]\n", argv[0]);
+			printConfigUsage();
+			return (EXIT_FAILURE);
+		}
+	}
 
-	while (isGameRunning)
+	// pipelined frames are rendered into the pipeline's buffers and uploaded from there
+	bool pipelined = config.pipelineDepth > 1;
+	isGameRunning = initializeWindow(config.renderWidth, config.renderHeight, config.framebufferLayout,
+		pipelined ? PRESENT_MODE_COPY : config.presentMode, config.upscaleMode);
+	if (isGameRunning)
+		isGameRunning = setup();
+	// before the render thread starts recording into it
+	if (isGameRunning)
+		isGameRunning = initializeProfiler(config.profile, config.profileFrames);
+	if (isGameRunning && pipelined)
+		isGameRunning = startFramePipeline(config.pipelineDepth, config.renderWidth, config.renderHeight, renderPipelinedFrame);
+
+	while (isGameRunning && pipelined)
 	{
+		uint64_t frameStart = beginProfileStage();
+		uint64_t stageStart = frameStart;
 		processInput();
-		update();
+		endProfileStage(PROFILE_INPUT, stageStart);
+		submitFrameInput(&input);
+		int frameWidth, frameHeight;
+		const color_t* frame = acquireFinishedFrame(&frameWidth, &frameHeight);
+		if (!frame)
+			break;
+		stageStart = beginProfileStage();
+		presentColorBuffer(frame, frameWidth, frameHeight, frameWidth);
+		endProfileStage(PROFILE_PRESENT, stageStart);
+		releaseFinishedFrame();
+		endProfileStage(PROFILE_FRAME, frameStart);
+	}
+	while (isGameRunning && !pipelined)
+	{
+		uint64_t frameStart = beginProfileStage();
+		processInput();
+		endProfileStage(PROFILE_INPUT, frameStart);
+		update(&input);
 		render();
+		endProfileStage(PROFILE_FRAME, frameStart);
+	}
+	if (pipelined)
+	{
+		stopFramePipeline();
+		printPipelineStats();
 	}
+	printProfileSummary();
+	if (config.profileCsvPath)
+		exportProfileCsv(config.profileCsvPath);
+	if (config.profileTracePath)
+		exportProfileTrace(config.profileTracePath);
 	releaseResources();
 	return (EXIT_SUCCESS);
 }
\ No newline at end of file
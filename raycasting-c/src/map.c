@@ -1,6 +1,8 @@
+#include <stdio.h>
 #include "map.h"
+#include "memory.h"
 
-static const int map[MAP_NUM_ROWS][MAP_NUM_COLS] = {
+static int map[MAP_NUM_ROWS][MAP_NUM_COLS] = {
     {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 ,1, 1, 1, 1, 1, 1, 1},
     {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1},
     {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1},
@@ -30,24 +32,69 @@ bool isInsideMap(float x, float y)
 	return (x >= 0 && x <= MAP_NUM_COLS * TILE_SIZE && y >= 0 && y <= MAP_NUM_ROWS * TILE_SIZE);
 }
 
+// Bumped on every change to the grid, so that caches derived from it know to rebuild.
+static unsigned mapVersion = 1;
+
+// The minimap tiles, rasterized once per map version and copied into each frame.
+static color_t* minimapLayer = NULL;
+static unsigned minimapLayerVersion = 0;
+
 int getMapAt(int i, int j)
 {
 	return map[i][j];
 }
 
-void renderMap() {
+void setMapAt(int i, int j, int value)
+{
+	if (i < 0 || i >= MAP_NUM_ROWS || j < 0 || j >= MAP_NUM_COLS || map[i][j] == value)
+		return;
+	map[i][j] = value;
+	mapVersion++;
+}
+
+unsigned getMapVersion()
+{
+	return mapVersion;
+}
+
+// Row-major MAP_NUM_ROWS x MAP_NUM_COLS grid, for the packet ray casters.
+const int* getMapGrid()
+{
+	return &map[0][0];
+}
+
+static void buildMinimapLayer() {
 	 for (int i = 0; i < MAP_NUM_ROWS; i++) {
             for (int j = 0; j < MAP_NUM_COLS; j++) {
-                int tileX = j * TILE_SIZE;
-                int tileY = i * TILE_SIZE;
-                int tileColor = map[i][j] != 0 ? 0xFFFFFFFF : 0x00000000;
-				drawRect(
-					MINIMAP_SCALE_FACTOR * tileX,
-					MINIMAP_SCALE_FACTOR * tileY,
-					MINIMAP_SCALE_FACTOR * TILE_SIZE,
-					MINIMAP_SCALE_FACTOR * TILE_SIZE,
-					tileColor
-				);
+                // scale both tile edges, so that the tiles meet without gaps
+                int tileX0 = MINIMAP_SCALE_FACTOR * j * TILE_SIZE;
+                int tileY0 = MINIMAP_SCALE_FACTOR * i * TILE_SIZE;
+                int tileX1 = MINIMAP_SCALE_FACTOR * (j + 1) * TILE_SIZE;
+                int tileY1 = MINIMAP_SCALE_FACTOR * (i + 1) * TILE_SIZE;
+                color_t tileColor = map[i][j] != 0 ? 0xFFFFFFFF : 0x00000000;
+				for (int y = tileY0; y < tileY1; y++)
+					for (int x = tileX0; x < tileX1; x++)
+						minimapLayer[y * MINIMAP_WIDTH + x] = tileColor;
             }
         }
+	minimapLayerVersion = mapVersion;
+}
+
+void renderMap() {
+	if (minimapLayer == NULL) {
+		minimapLayer = (color_t*)alignedAlloc(sizeof(color_t) * MINIMAP_WIDTH * MINIMAP_HEIGHT);
+		if (minimapLayer == NULL) {
+			fprintf(stderr, "Error allocating minimap layer.\n");
+			return;
+		}
+		minimapLayerVersion = 0;
+	}
+	if (minimapLayerVersion != mapVersion)
+		buildMinimapLayer();
+	drawImage(0, 0, MINIMAP_WIDTH, MINIMAP_HEIGHT, minimapLayer, MINIMAP_WIDTH);
+}
+
+void freeMinimapLayer() {
+	alignedFree(minimapLayer);
+	minimapLayer = NULL;
 }
\ No newline at end of file
@@ -7,11 +7,18 @@
 
 #define MAP_NUM_ROWS 13
 #define MAP_NUM_COLS 20
+// The minimap tiles cover this top-left rectangle of the framebuffer exactly.
+#define MINIMAP_WIDTH ((int)(MINIMAP_SCALE_FACTOR * MAP_NUM_COLS * TILE_SIZE))
+#define MINIMAP_HEIGHT ((int)(MINIMAP_SCALE_FACTOR * MAP_NUM_ROWS * TILE_SIZE))
 
 bool mapHasWallAt(float x, float y);
 bool isInsideMap(float x, float y);
 void renderMap(void);
+void freeMinimapLayer(void);
 int getMapAt(int i, int j);
+void setMapAt(int i, int j, int value);
+unsigned getMapVersion(void);
+const int* getMapGrid(void);
 
 
 
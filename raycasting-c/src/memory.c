@@ -0,0 +1,19 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include "memory.h"
+
+// Cache-line aligned allocation, so SIMD loads and per-thread bands do not share lines.
+void* alignedAlloc(size_t size)
+{
+	void* pointer = NULL;
+	if (size == 0)
+		size = CACHE_LINE_SIZE;
+	if (posix_memalign(&pointer, CACHE_LINE_SIZE, size) != 0)
+		return NULL;
+	return pointer;
+}
+
+void alignedFree(void* pointer)
+{
+	free(pointer);
+}
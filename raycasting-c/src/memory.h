@@ -0,0 +1,11 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+void* alignedAlloc(size_t size);
+void alignedFree(void* pointer);
+
+#endif
@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "graphics.h"
+#include "memory.h"
+#include "timer.h"
+
+// A ring of frame slots: the render thread fills them in order while the main thread
+// presents them in the same order, so rendering frame N + 1 overlaps presenting frame N.
+typedef enum {
+	SLOT_FREE,
+	SLOT_RENDERING,
+	SLOT_READY,
+	SLOT_PRESENTING
+} slot_state_t;
+
+typedef struct {
+	color_t* pixels;
+	int width;  // resolution the frame was rendered at, rows are width pixels apart
+	int height;
+	slot_state_t state;
+	uint64_t inputNs;
+} frame_slot_t;
+
+static struct {
+	bool running;
+	bool stopping;
+	int depth;
+	frame_slot_t slots[MAX_PIPELINE_DEPTH];
+	int renderSlot;
+	int presentSlot;
+	uint64_t acquiredNs;
+
+	frame_render_fn_t render;
+	frame_input_t input;
+	uint64_t inputNs; // when input was sampled
+
+	pthread_t renderThread;
+	pthread_mutex_t mutex;
+	pthread_cond_t slotFree;
+	pthread_cond_t frameReady;
+
+	pipeline_stats_t stats;
+} pipeline = {
+	.running = false,
+};
+
+static void* renderThreadMain(void* arg)
+{
+	(void)arg;
+	for (;;)
+	{
+		frame_slot_t* slot = &pipeline.slots[pipeline.renderSlot];
+		frame_input_t input;
+		uint64_t inputNs;
+
+		uint64_t waitStart = getTimeNanoseconds();
+		pthread_mutex_lock(&pipeline.mutex);
+		while (slot->state != SLOT_FREE && !pipeline.stopping)
+			pthread_cond_wait(&pipeline.slotFree, &pipeline.mutex);
+		if (pipeline.stopping)
+		{
+			pthread_mutex_unlock(&pipeline.mutex);
+			return NULL;
+		}
+		slot->state = SLOT_RENDERING;
+		input = pipeline.input;
+		inputNs = pipeline.inputNs;
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		uint64_t renderStart = getTimeNanoseconds();
+		slot->inputNs = inputNs;
+		slot->width = getRenderWidth();
+		slot->height = getRenderHeight();
+		setColorBufferTarget(slot->pixels, slot->width);
+		pipeline.render(&input);
+		uint64_t renderEnd = getTimeNanoseconds();
+
+		pthread_mutex_lock(&pipeline.mutex);
+		slot->state = SLOT_READY;
+		pipeline.stats.renderWaitNs += renderStart - waitStart;
+		pipeline.stats.renderNs += renderEnd - renderStart;
+		pthread_cond_signal(&pipeline.frameReady);
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		pipeline.renderSlot = (pipeline.renderSlot + 1) % pipeline.depth;
+	}
+}
+
+// depth is the number of frame buffers in flight, 2 for double and 3 for triple buffering;
+// each holds a frame of up to maxWidth x maxHeight.
+bool startFramePipeline(int depth, int maxWidth, int maxHeight, frame_render_fn_t render)
+{
+	if (depth < 2)
+		depth = 2;
+	if (depth > MAX_PIPELINE_DEPTH)
+		depth = MAX_PIPELINE_DEPTH;
+
+	pipeline.depth = depth;
+	pipeline.render = render;
+	pipeline.stopping = false;
+	pipeline.renderSlot = 0;
+	pipeline.presentSlot = 0;
+	pipeline.stats = (pipeline_stats_t){ 0 };
+	pipeline.inputNs = getTimeNanoseconds();
+	for (int i = 0; i < depth; i++)
+	{
+		pipeline.slots[i].state = SLOT_FREE;
+		pipeline.slots[i].pixels = (color_t*)alignedAlloc(sizeof(color_t) * maxWidth * maxHeight);
+		if (!pipeline.slots[i].pixels)
+		{
+			fprintf(stderr, "Error allocating frame pipeline buffers.\n");
+			for (int j = 0; j <= i; j++)
+				alignedFree(pipeline.slots[j].pixels);
+			return false;
+		}
+	}
+
+	pthread_mutex_init(&pipeline.mutex, NULL);
+	pthread_cond_init(&pipeline.slotFree, NULL);
+	pthread_cond_init(&pipeline.frameReady, NULL);
+	if (pthread_create(&pipeline.renderThread, NULL, renderThreadMain, NULL) != 0)
+	{
+		fprintf(stderr, "Error creating render thread.\n");
+		pthread_cond_destroy(&pipeline.frameReady);
+		pthread_cond_destroy(&pipeline.slotFree);
+		pthread_mutex_destroy(&pipeline.mutex);
+		for (int i = 0; i < depth; i++)
+			alignedFree(pipeline.slots[i].pixels);
+		return false;
+	}
+	pipeline.running = true;
+	return true;
+}
+
+void stopFramePipeline()
+{
+	if (!pipeline.running)
+		return;
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.stopping = true;
+	pthread_cond_broadcast(&pipeline.slotFree);
+	pthread_cond_broadcast(&pipeline.frameReady);
+	pthread_mutex_unlock(&pipeline.mutex);
+	pthread_join(pipeline.renderThread, NULL);
+
+	pthread_cond_destroy(&pipeline.frameReady);
+	pthread_cond_destroy(&pipeline.slotFree);
+	pthread_mutex_destroy(&pipeline.mutex);
+	for (int i = 0; i < pipeline.depth; i++)
+	{
+		alignedFree(pipeline.slots[i].pixels);
+		pipeline.slots[i].pixels = NULL;
+	}
+	pipeline.running = false;
+}
+
+void submitFrameInput(const frame_input_t* input)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.input = *input;
+	pipeline.inputNs = getTimeNanoseconds();
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+// Main thread: waits for the oldest finished frame and returns its row-major pixels and size,
+// or NULL once the pipeline is stopping. Pair each frame with releaseFinishedFrame().
+const color_t* acquireFinishedFrame(int* width, int* height)
+{
+	frame_slot_t* slot = &pipeline.slots[pipeline.presentSlot];
+
+	uint64_t waitStart = getTimeNanoseconds();
+	pthread_mutex_lock(&pipeline.mutex);
+	while (slot->state != SLOT_READY && !pipeline.stopping)
+		pthread_cond_wait(&pipeline.frameReady, &pipeline.mutex);
+	if (slot->state != SLOT_READY)
+	{
+		pthread_mutex_unlock(&pipeline.mutex);
+		return NULL;
+	}
+	slot->state = SLOT_PRESENTING;
+	pipeline.acquiredNs = getTimeNanoseconds();
+	pipeline.stats.presentWaitNs += pipeline.acquiredNs - waitStart;
+	pthread_mutex_unlock(&pipeline.mutex);
+	*width = slot->width;
+	*height = slot->height;
+	return slot->pixels;
+}
+
+void releaseFinishedFrame()
+{
+	frame_slot_t* slot = &pipeline.slots[pipeline.presentSlot];
+	uint64_t now = getTimeNanoseconds();
+	uint64_t latency = now - slot->inputNs;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	slot->state = SLOT_FREE;
+	pipeline.stats.frames++;
+	pipeline.stats.presentNs += now - pipeline.acquiredNs;
+	pipeline.stats.latencyNs += latency;
+	if (latency > pipeline.stats.maxLatencyNs)
+		pipeline.stats.maxLatencyNs = latency;
+	pthread_cond_signal(&pipeline.slotFree);
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	pipeline.presentSlot = (pipeline.presentSlot + 1) % pipeline.depth;
+}
+
+pipeline_stats_t getPipelineStats()
+{
+	pipeline_stats_t stats;
+	if (!pipeline.running)
+		return pipeline.stats;
+	pthread_mutex_lock(&pipeline.mutex);
+	stats = pipeline.stats;
+	pthread_mutex_unlock(&pipeline.mutex);
+	return stats;
+}
+
+void printPipelineStats()
+{
+	pipeline_stats_t stats = getPipelineStats();
+	if (stats.frames == 0)
+		return;
+	double frames = stats.frames;
+	printf("pipeline: %d frames, depth %d\n", stats.frames, pipeline.depth);
+	printf("  render  %8.2f ms/frame, waiting for a slot %8.2f ms/frame\n", stats.renderNs / frames / 1e6, stats.renderWaitNs / frames / 1e6);
+	printf("  present %8.2f ms/frame, waiting for a frame %7.2f ms/frame\n", stats.presentNs / frames / 1e6, stats.presentWaitNs / frames / 1e6);
+	printf("  latency %8.2f ms average, %.2f ms max (input sampled to presented)\n", stats.latencyNs / frames / 1e6, stats.maxLatencyNs / 1e6);
+}
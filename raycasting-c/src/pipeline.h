@@ -0,0 +1,37 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "defs.h"
+
+#define MAX_PIPELINE_DEPTH 4
+
+// Input sampled on the main thread, handed to the frame that starts next.
+typedef struct {
+	int walkDirection;
+	int turnDirection;
+} frame_input_t;
+
+// Runs on the render thread: simulates and draws one frame into the current color buffer target.
+typedef void (*frame_render_fn_t)(const frame_input_t* input);
+
+typedef struct {
+	int frames;
+	uint64_t renderNs;       // render thread time spent in the frame function
+	uint64_t presentNs;      // main thread time between acquiring and releasing a frame
+	uint64_t renderWaitNs;   // render thread blocked on a free slot
+	uint64_t presentWaitNs;  // main thread blocked on a finished frame
+	uint64_t latencyNs;      // input sampled to frame presented
+	uint64_t maxLatencyNs;
+} pipeline_stats_t;
+
+bool startFramePipeline(int depth, int maxWidth, int maxHeight, frame_render_fn_t render);
+void stopFramePipeline(void);
+void submitFrameInput(const frame_input_t* input);
+const color_t* acquireFinishedFrame(int* width, int* height);
+void releaseFinishedFrame(void);
+pipeline_stats_t getPipelineStats(void);
+void printPipelineStats(void);
+
+#endif
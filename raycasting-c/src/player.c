@@ -1,8 +1,8 @@
 #include "player.h"
 
 player_t player = {
-	.x = WINDOW_WIDTH / 2,
-	.y = WINDOW_HEIGHT / 2,
+	.x = DEFAULT_RENDER_WIDTH / 2,
+	.y = DEFAULT_RENDER_HEIGHT / 2,
 	.width = 1,
 	.height = 1,
 	.turnDirection = 0,
@@ -13,20 +13,29 @@ player_t player = {
 	.turnSpeed = 45 * (PI / 180),
 };
 
-void movePlayer(float deltaTime)
+void movePlayer(player_t* state, float deltaTime)
 {
-	player.rotationAngle += player.turnDirection * player.turnSpeed * deltaTime;
-	float moveStep = player.walkDirection * player.walkSpeed * deltaTime;
+	state->rotationAngle += state->turnDirection * state->turnSpeed * deltaTime;
+	float moveStep = state->walkDirection * state->walkSpeed * deltaTime;
 
-	float newPlayerX = player.x + cos(player.rotationAngle) * moveStep;
-	float newPlayerY = player.y + sin(player.rotationAngle) * moveStep;
+	float newPlayerX = state->x + cos(state->rotationAngle) * moveStep;
+	float newPlayerY = state->y + sin(state->rotationAngle) * moveStep;
 	if(!mapHasWallAt(newPlayerX, newPlayerY))
 	{
-		player.x = newPlayerX;
-		player.y = newPlayerY;
+		state->x = newPlayerX;
+		state->y = newPlayerY;
 	}
 }
 
+// The pose alpha of the way from previous to current; rotationAngle is never wrapped, so it lerps too.
+void interpolatePlayer(player_t* out, const player_t* previous, const player_t* current, float alpha)
+{
+	*out = *current;
+	out->x = previous->x + (current->x - previous->x) * alpha;
+	out->y = previous->y + (current->y - previous->y) * alpha;
+	out->rotationAngle = previous->rotationAngle + (current->rotationAngle - previous->rotationAngle) * alpha;
+}
+
 void renderPlayer()
 {
 	drawRect(
@@ -19,7 +19,8 @@ typedef struct {
 
 extern player_t player;
 
-void movePlayer(float deltaTime);
+void movePlayer(player_t* state, float deltaTime);
+void interpolatePlayer(player_t* out, const player_t* previous, const player_t* current, float alpha);
 void renderPlayer(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "profiler.h"
+#include "timer.h"
+
+const char* const profileStageNames[NUM_PROFILE_STAGES] = {
+	"frame",
+	"processInput",
+	"movePlayer",
+	"castAllRays",
+	"clear",
+	"renderWallProjection",
+	"minimap",
+	"present",
+};
+
+typedef struct {
+	uint64_t startNs;
+	uint64_t durationNs;
+	int thread; // 1 on the thread that initialized the profiler, 2 on any other
+} profile_sample_t;
+
+typedef struct {
+	profile_sample_t* samples; // ring of historyFrames entries
+	uint64_t count;            // samples ever recorded; the newest is at (count - 1) % historyFrames
+} profile_ring_t;
+
+static struct {
+	bool enabled;
+	int historyFrames;
+	uint64_t originNs;
+	pthread_t mainThread;
+	profile_ring_t rings[NUM_PROFILE_STAGES];
+} profiler = {
+	.enabled = false,
+};
+
+bool initializeProfiler(bool enabled, int historyFrames)
+{
+	freeProfiler();
+	if (!enabled)
+		return true;
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+	{
+		profiler.rings[s].samples = (profile_sample_t*)malloc(sizeof(profile_sample_t) * historyFrames);
+		profiler.rings[s].count = 0;
+		if (profiler.rings[s].samples == NULL)
+		{
+			fprintf(stderr, "Error allocating profiler history.\n");
+			freeProfiler();
+			return false;
+		}
+	}
+	profiler.historyFrames = historyFrames;
+	profiler.originNs = getTimeNanoseconds();
+	profiler.mainThread = pthread_self();
+	profiler.enabled = true;
+	return true;
+}
+
+void freeProfiler()
+{
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+	{
+		free(profiler.rings[s].samples);
+		profiler.rings[s].samples = NULL;
+		profiler.rings[s].count = 0;
+	}
+	profiler.enabled = false;
+}
+
+bool isProfilerEnabled()
+{
+	return profiler.enabled;
+}
+
+// Start of a scoped stage timer; 0 without reading the clock when profiling is off.
+uint64_t beginProfileStage()
+{
+	return profiler.enabled ? getTimeNanoseconds() : 0;
+}
+
+void endProfileStage(profile_stage_t stage, uint64_t startNs)
+{
+	if (profiler.enabled)
+		recordProfileStage(stage, startNs, getTimeNanoseconds());
+}
+
+void recordProfileStage(profile_stage_t stage, uint64_t startNs, uint64_t endNs)
+{
+	if (!profiler.enabled)
+		return;
+	profile_ring_t* ring = &profiler.rings[stage];
+	profile_sample_t* sample = &ring->samples[ring->count % profiler.historyFrames];
+	sample->startNs = startNs;
+	sample->durationNs = endNs - startNs;
+	sample->thread = pthread_equal(pthread_self(), profiler.mainThread) ? 1 : 2;
+	ring->count++;
+}
+
+// Samples still in the ring, and the index of the oldest of them.
+static int getRingSpan(const profile_ring_t* ring, int* first)
+{
+	int size = ring->count < (uint64_t)profiler.historyFrames ? (int)ring->count : profiler.historyFrames;
+	*first = (int)((ring->count - size) % profiler.historyFrames);
+	return size;
+}
+
+static int compareDurations(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted durations.
+static uint64_t getPercentile(const uint64_t* sorted, int size, int percent)
+{
+	int rank = (percent * size + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void printProfileSummary()
+{
+	if (!profiler.enabled)
+		return;
+	uint64_t* durations = (uint64_t*)malloc(sizeof(uint64_t) * profiler.historyFrames);
+	if (durations == NULL)
+	{
+		fprintf(stderr, "Error allocating profiler summary.\n");
+		return;
+	}
+	printf("profile: last %d frames, ms\n", profiler.historyFrames);
+	printf("  %-22s %8s %8s %8s %8s %8s\n", "stage", "samples", "p50", "p95", "p99", "max");
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+	{
+		const profile_ring_t* ring = &profiler.rings[s];
+		int first;
+		int size = getRingSpan(ring, &first);
+		if (size == 0)
+			continue;
+		for (int i = 0; i < size; i++)
+			durations[i] = ring->samples[(first + i) % profiler.historyFrames].durationNs;
+		qsort(durations, size, sizeof(uint64_t), compareDurations);
+		printf("  %-22s %8d %8.3f %8.3f %8.3f %8.3f\n", profileStageNames[s], size,
+			getPercentile(durations, size, 50) / 1e6, getPercentile(durations, size, 95) / 1e6,
+			getPercentile(durations, size, 99) / 1e6, durations[size - 1] / 1e6);
+	}
+	free(durations);
+}
+
+// One row per sample: stage, its sample number, thread, start and duration in microseconds.
+bool exportProfileCsv(const char* path)
+{
+	if (!profiler.enabled)
+		return true;
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error opening %s for the profile.\n", path);
+		return false;
+	}
+	fprintf(file, "stage,sample,thread,start_us,duration_us\n");
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+	{
+		const profile_ring_t* ring = &profiler.rings[s];
+		int first;
+		int size = getRingSpan(ring, &first);
+		for (int i = 0; i < size; i++)
+		{
+			const profile_sample_t* sample = &ring->samples[(first + i) % profiler.historyFrames];
+			fprintf(file, "%s,%llu,%d,%.3f,%.3f\n", profileStageNames[s],
+				(unsigned long long)(ring->count - size + i), sample->thread,
+				(sample->startNs - profiler.originNs) / 1e3, sample->durationNs / 1e3);
+		}
+	}
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written)
+	{
+		fprintf(stderr, "Error writing the profile to %s.\n", path);
+		return false;
+	}
+	return true;
+}
+
+// Complete ("X") events in the Chrome trace event format, for chrome://tracing or Perfetto.
+bool exportProfileTrace(const char* path)
+{
+	if (!profiler.enabled)
+		return true;
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error opening %s for the profile trace.\n", path);
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}},\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"render\"}}");
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+	{
+		const profile_ring_t* ring = &profiler.rings[s];
+		int first;
+		int size = getRingSpan(ring, &first);
+		for (int i = 0; i < size; i++)
+		{
+			const profile_sample_t* sample = &ring->samples[(first + i) % profiler.historyFrames];
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"sample\":%llu}}",
+				profileStageNames[s], (sample->startNs - profiler.originNs) / 1e3, sample->durationNs / 1e3,
+				sample->thread, (unsigned long long)(ring->count - size + i));
+		}
+	}
+	fprintf(file, "\n]}\n");
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written)
+	{
+		fprintf(stderr, "Error writing the profile trace to %s.\n", path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,33 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	PROFILE_FRAME,   // one pass of the main loop
+	PROFILE_INPUT,
+	PROFILE_MOVE,
+	PROFILE_CAST,
+	PROFILE_CLEAR,
+	PROFILE_WALL,
+	PROFILE_MINIMAP, // renderMap, renderPlayer and renderRays
+	PROFILE_PRESENT,
+	NUM_PROFILE_STAGES
+} profile_stage_t;
+
+extern const char* const profileStageNames[NUM_PROFILE_STAGES];
+
+// Each stage keeps its own ring of the last historyFrames samples and must only be
+// recorded from one thread at a time; the summary and exports read them after the frames.
+bool initializeProfiler(bool enabled, int historyFrames);
+void freeProfiler(void);
+bool isProfilerEnabled(void);
+uint64_t beginProfileStage(void);
+void endProfileStage(profile_stage_t stage, uint64_t startNs);
+void recordProfileStage(profile_stage_t stage, uint64_t startNs, uint64_t endNs);
+void printProfileSummary(void);
+bool exportProfileCsv(const char* path);
+bool exportProfileTrace(const char* path);
+
+#endif
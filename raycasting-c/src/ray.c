@@ -1,158 +1,190 @@
+#include <stdio.h>
 #include "ray.h"
+#include "raypacket.h"
+#include "memory.h"
 
-ray_t rays[NUM_RAYS];
+ray_buffer_t rays = {
+	.count = 0,
+};
 
-void normalizeAngle(float *angle)
+static ray_caster_t rayCaster = RAY_CASTER_SCALAR;
+static ray_packet_fn_t castRayPacket = NULL;
+static int rayPacketWidth = 1;
+
+bool initializeRays(int numRays)
 {
-	*angle = remainder(*angle , TWO_PI);
-	if (*angle < 0)
-		*angle = TWO_PI + *angle;
+	freeRays();
+	rays.rayAngle = (float*)alignedAlloc(sizeof(float) * numRays);
+	rays.distance = (float*)alignedAlloc(sizeof(float) * numRays);
+	rays.wallHitX = (float*)alignedAlloc(sizeof(float) * numRays);
+	rays.wallHitY = (float*)alignedAlloc(sizeof(float) * numRays);
+	rays.wallHitOffset = (int*)alignedAlloc(sizeof(int) * numRays);
+	rays.wallHitContent = (int*)alignedAlloc(sizeof(int) * numRays);
+	rays.wasHitVertical = (uint8_t*)alignedAlloc(sizeof(uint8_t) * numRays);
+	if (!rays.rayAngle || !rays.distance || !rays.wallHitX || !rays.wallHitY
+		|| !rays.wallHitOffset || !rays.wallHitContent || !rays.wasHitVertical)
+	{
+		fprintf(stderr, "Error allocating ray buffer.\n");
+		freeRays();
+		return false;
+	}
+	rays.count = numRays;
+	return true;
 }
 
-float distanceBetweenPoints(float x1, float y1, float x2, float y2)
+void freeRays()
 {
-	return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+	alignedFree(rays.rayAngle);
+	alignedFree(rays.distance);
+	alignedFree(rays.wallHitX);
+	alignedFree(rays.wallHitY);
+	alignedFree(rays.wallHitOffset);
+	alignedFree(rays.wallHitContent);
+	alignedFree(rays.wasHitVertical);
+	rays.rayAngle = rays.distance = rays.wallHitX = rays.wallHitY = NULL;
+	rays.wallHitOffset = rays.wallHitContent = NULL;
+	rays.wasHitVertical = NULL;
+	rays.count = 0;
 }
 
-void castRay(float rayAngle, int stripId)
+void normalizeAngle(float *angle)
 {
-	normalizeAngle(&rayAngle);
-
-	bool isRayFacingDown = rayAngle > 0 && rayAngle < PI;
-	bool isRayFacingUp = !isRayFacingDown;
-
-	bool isRayFacingRight = rayAngle < 0.5 * PI || rayAngle > 1.5 * PI;
-	bool isRayFacingLeft = !isRayFacingRight;
-
-	float xintercept, yintercept;
-	float xstep, ystep;
-
-	//Horizontal ray-grid intersection code.
-	bool foundHorzWallHit = false;
-	float horzWallHitX = 0;
-	float horzWallHitY = 0;
-	int horzWallContent = 0;
-
-	yintercept = floor(player.y / TILE_SIZE) * TILE_SIZE;
-	yintercept += isRayFacingDown ? TILE_SIZE : 0;
-
-	xintercept = player.x + (yintercept - player.y) / tan(rayAngle);
-
-	ystep = TILE_SIZE;
-	ystep *= isRayFacingUp ? -1 : 1;
-
-	// TILE_SIZE is ystep. xstep adjusted by ystep.
-	xstep = TILE_SIZE / tan(rayAngle);
-
-	//When a race that was facing left last time turns to the right.
-	xstep *= (isRayFacingLeft && xstep > 0) ? -1 : 1;
-	//When a race that was facing right last time turns to the left.
-	xstep *= (isRayFacingRight && xstep < 0) ? -1 : 1;
-
-	float nextHorzTouchX = xintercept;
-	float nextHorzTouchY = yintercept;
+	*angle = remainder(*angle , TWO_PI);
+	if (*angle < 0)
+		*angle = TWO_PI + *angle;
+}
 
-	while (isInsideMap(nextHorzTouchX, nextHorzTouchY))
+// Single-pass grid DDA: steps through the cells the ray crosses in distance order
+// and stops at the first wall, so only one march is done and no sqrt is needed.
+// The packet casters in raypacket.c follow the same float operations lane by lane.
+static void traceRay(float rayAngle, float rayDirX, float rayDirY, int stripId)
+{
+	int mapX = (int)(player.x / TILE_SIZE);
+	int mapY = (int)(player.y / TILE_SIZE);
+	int stepX = rayDirX < 0 ? -1 : 1;
+	int stepY = rayDirY < 0 ? -1 : 1;
+
+	// Ray length from the player to the first vertical / horizontal grid line,
+	// and between two consecutive ones. A zero direction gives an infinite length.
+	float sideDistX = (rayDirX < 0 ? player.x - mapX * TILE_SIZE : (mapX + 1) * TILE_SIZE - player.x) / fabsf(rayDirX);
+	float sideDistY = (rayDirY < 0 ? player.y - mapY * TILE_SIZE : (mapY + 1) * TILE_SIZE - player.y) / fabsf(rayDirY);
+	float deltaDistX = TILE_SIZE / fabsf(rayDirX);
+	float deltaDistY = TILE_SIZE / fabsf(rayDirY);
+
+	float distance;
+	bool wasHitVertical;
+	int wallHitContent = 0;
+	for (;;)
 	{
-		float xToCheck = nextHorzTouchX;
-		// In the case up, it is changed cell by incrementing pixel.
-		float yToCheck = nextHorzTouchY + (isRayFacingUp ? -1 : 0);
-
-		if (mapHasWallAt(xToCheck, yToCheck)) {
-			horzWallHitX = nextHorzTouchX;
-			horzWallHitY = nextHorzTouchY;
-			horzWallContent = getMapAt((int)floor(yToCheck / TILE_SIZE), (int)floor(xToCheck / TILE_SIZE));
-			foundHorzWallHit = true;
-			break;
-		} else {
-			nextHorzTouchX += xstep;
-			nextHorzTouchY += ystep;
+		if (sideDistX < sideDistY)
+		{
+			distance = sideDistX;
+			sideDistX += deltaDistX;
+			mapX += stepX;
+			wasHitVertical = true;
+		}
+		else
+		{
+			distance = sideDistY;
+			sideDistY += deltaDistY;
+			mapY += stepY;
+			wasHitVertical = false;
 		}
+		if (mapX < 0 || mapX >= MAP_NUM_COLS || mapY < 0 || mapY >= MAP_NUM_ROWS)
+			break;
+		wallHitContent = getMapAt(mapY, mapX);
+		if (wallHitContent != 0)
+			break;
 	}
 
-	//Vertical ray-grid intersection code.
-	bool foundVertWallHit = false;
-	float vertWallHitX = 0;
-	float vertWallHitY = 0;
-	int vertWallContent = 0;
+	float wallHitX = player.x + distance * rayDirX;
+	float wallHitY = player.y + distance * rayDirY;
 
-	xintercept = floor(player.x / TILE_SIZE) * TILE_SIZE;
-	xintercept += isRayFacingRight ? TILE_SIZE : 0;
+	rays.rayAngle[stripId] = rayAngle;
+	rays.distance[stripId] = wallHitContent != 0 ? distance : FLT_MAX;
+	rays.wallHitX[stripId] = wallHitX;
+	rays.wallHitY[stripId] = wallHitY;
+	rays.wallHitOffset[stripId] = (int)(wasHitVertical ? wallHitY : wallHitX) % TILE_SIZE;
+	rays.wallHitContent[stripId] = wallHitContent;
+	rays.wasHitVertical[stripId] = wasHitVertical;
+}
 
-	yintercept = player.y + (xintercept - player.x) * tan(rayAngle);
+void initializeRayCaster(ray_caster_t caster)
+{
+	rayPacketWidth = selectRayPacketCaster(caster, &castRayPacket);
+	rayCaster = rayPacketWidth == 8 ? RAY_CASTER_AVX2 : rayPacketWidth == 4 ? RAY_CASTER_SSE : RAY_CASTER_SCALAR;
+}
 
-	xstep = TILE_SIZE;
-	xstep *= isRayFacingLeft ? -1 : 1;
+const char* getRayCasterName()
+{
+	return rayCasterNames[rayCaster];
+}
 
-	ystep = TILE_SIZE * tan(rayAngle);
-	ystep *= (isRayFacingUp && ystep > 0) ? -1 : 1;
-	ystep *= (isRayFacingDown && ystep < 0) ? -1 : 1;
+// View direction shared by all columns of a frame; each column's ray is this
+// direction rotated by the camera's per-column angle, so no trig runs per column.
+typedef struct {
+	float viewAngle;
+	float viewCos;
+	float viewSin;
+} ray_frame_t;
 
-	float nextVertTouchX = xintercept;
-	float nextVertTouchY = yintercept;
+static void getColumnRay(const ray_frame_t* frame, int col, float* rayAngle, float* rayDirX, float* rayDirY)
+{
+	*rayAngle = frame->viewAngle + camera.columnAngle[col];
+	if (*rayAngle < 0)
+		*rayAngle += TWO_PI;
+	else if (*rayAngle >= TWO_PI)
+		*rayAngle -= TWO_PI;
+	*rayDirX = frame->viewCos * camera.columnCos[col] - frame->viewSin * camera.columnSin[col];
+	*rayDirY = frame->viewSin * camera.columnCos[col] + frame->viewCos * camera.columnSin[col];
+}
 
-	while(isInsideMap(nextVertTouchX, nextVertTouchY))
-	{
-		float xToCheck = nextVertTouchX + (isRayFacingLeft ? -1 : 0);
-		float yToCheck = nextVertTouchY;
-
-		if (mapHasWallAt(xToCheck, yToCheck)) {
-			vertWallHitX = nextVertTouchX;
-			vertWallHitY = nextVertTouchY;
-			vertWallContent = getMapAt((int)floor(yToCheck / TILE_SIZE), (int)floor(xToCheck / TILE_SIZE));
-			foundVertWallHit = true;
-			break;
-		} else {
-			nextVertTouchX += xstep;
-			nextVertTouchY += ystep;
-		}
-	}
+static void castRayBand(void* context, int begin, int end)
+{
+	const ray_frame_t* frame = (const ray_frame_t*)context;
+	float rayAngle[MAX_RAY_PACKET_WIDTH];
+	float rayDirX[MAX_RAY_PACKET_WIDTH];
+	float rayDirY[MAX_RAY_PACKET_WIDTH];
+	int col = begin;
 
-	float horzHitDistance = foundHorzWallHit
-									? distanceBetweenPoints(player.x, player.y, horzWallHitX, horzWallHitY)
-									: FLT_MAX;
-	float vertHitDistance = foundVertWallHit
-									? distanceBetweenPoints(player.x, player.y, vertWallHitX, vertWallHitY)
-									: FLT_MAX;
-	if(horzHitDistance > vertHitDistance)
+	if (rayPacketWidth > 1)
 	{
-		rays[stripId].distance = vertHitDistance;
-		rays[stripId].wallHitX = vertWallHitX;
-		rays[stripId].wallHitY = vertWallHitY;
-		rays[stripId].wallHitContent = vertWallContent;
-		rays[stripId].wasHitVertical = true;
-		rays[stripId].rayAngle = rayAngle;
+		for (; col + rayPacketWidth <= end; col += rayPacketWidth)
+		{
+			for (int lane = 0; lane < rayPacketWidth; lane++)
+				getColumnRay(frame, col + lane, &rayAngle[lane], &rayDirX[lane], &rayDirY[lane]);
+			castRayPacket(rayAngle, rayDirX, rayDirY, col);
+		}
 	}
-	else
+	for (; col < end; col++)
 	{
-		rays[stripId].distance = horzHitDistance;
-		rays[stripId].wallHitX = horzWallHitX;
-		rays[stripId].wallHitY = horzWallHitY;
-		rays[stripId].wallHitContent = horzWallContent;
-		rays[stripId].wasHitVertical = false;
-		rays[stripId].rayAngle = rayAngle;
+		getColumnRay(frame, col, &rayAngle[0], &rayDirX[0], &rayDirY[0]);
+		traceRay(rayAngle[0], rayDirX[0], rayDirY[0], col);
 	}
 }
 
+// Each column only reads player and the map and writes its own rays entries,
+// so the columns can be cast in bands on the worker pool.
 void castAllRays()
 {
-	// float rayAngle = player.rotationAngle - (FOV_ANGLE / 2);
-	for (int col = 0; col < NUM_RAYS; col++)
-	{
-		float rayAngle = player.rotationAngle + atan((col - NUM_RAYS / 2) / DIST_PROJ_PLANE);
-		castRay(rayAngle, col);
-	}
+	ray_frame_t frame;
+	frame.viewAngle = player.rotationAngle;
+	normalizeAngle(&frame.viewAngle);
+	frame.viewCos = cos(frame.viewAngle);
+	frame.viewSin = sin(frame.viewAngle);
+
+	parallelFor(camera.numColumns, castRayBand, &frame);
 }
 
 void renderRays()
 {
-	for (int i = 0; i < NUM_RAYS; i += 50)
+	for (int i = 0; i < camera.numColumns; i += 50)
 	{
 		drawLine(
 			MINIMAP_SCALE_FACTOR * player.x,
 			MINIMAP_SCALE_FACTOR * player.y,
-			MINIMAP_SCALE_FACTOR * rays[i].wallHitX,
-			MINIMAP_SCALE_FACTOR * rays[i].wallHitY,
+			MINIMAP_SCALE_FACTOR * getRayWallHitX(i),
+			MINIMAP_SCALE_FACTOR * getRayWallHitY(i),
 			0xFF0000FF
 		);
 	}
@@ -2,27 +2,47 @@
 #define RAY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <limits.h>
+#include <float.h>
 #include "defs.h"
+#include "config.h"
 #include "player.h"
+#include "camera.h"
 #include "graphics.h"
+#include "threadpool.h"
 
+#include <stdint.h>
+
+// Ray results as one cache-line aligned array per field (structure of arrays),
+// so the wall pass and the packet casters read and write whole vectors of columns.
 typedef struct {
-	float rayAngle;
-	float wallHitX;
-	float wallHitY;
-	float distance;
-	int wallHitContent;
-	bool wasHitVertical;
-} ray_t;
+	int count;
+	float* rayAngle;
+	float* distance;
+	float* wallHitX;
+	float* wallHitY;
+	int* wallHitOffset; // position of the hit along the wall, 0 .. TILE_SIZE - 1
+	int* wallHitContent;
+	uint8_t* wasHitVertical;
+} ray_buffer_t;
+
+extern ray_buffer_t rays;
 
-//　Not initialized　Variable.
-extern ray_t rays[NUM_RAYS];
+static inline float getRayAngle(int stripId) { return rays.rayAngle[stripId]; }
+static inline float getRayDistance(int stripId) { return rays.distance[stripId]; }
+static inline float getRayWallHitX(int stripId) { return rays.wallHitX[stripId]; }
+static inline float getRayWallHitY(int stripId) { return rays.wallHitY[stripId]; }
+static inline int getRayWallHitOffset(int stripId) { return rays.wallHitOffset[stripId]; }
+static inline int getRayWallHitContent(int stripId) { return rays.wallHitContent[stripId]; }
+static inline bool getRayWasHitVertical(int stripId) { return rays.wasHitVertical[stripId] != 0; }
 
+bool initializeRays(int numRays);
+void freeRays(void);
 void normalizeAngle(float *angle);
-float distanceBetweenPoints(float x1, float y1, float x2, float y2);
+void initializeRayCaster(ray_caster_t caster);
+const char* getRayCasterName(void);
 void castAllRays(void);
-void castRay(float rayAngle, int stripId);
 void renderRays(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include "raypacket.h"
+#include "map.h"
+#include "player.h"
+#include "ray.h"
+
+// Packet versions of the grid DDA in traceRay(). Every lane runs the same float
+// operations in the same order as the scalar code, so the output is bit-identical;
+// lanes are masked off as they hit a wall or leave the map.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_RAY_PACKETS
+#endif
+
+#ifdef HAVE_X86_RAY_PACKETS
+
+static void storeWasHitVertical(int firstStripId, int width, int verticalBits)
+{
+	for (int lane = 0; lane < width; lane++)
+		rays.wasHitVertical[firstStripId + lane] = (verticalBits >> lane) & 1;
+}
+
+static __m128 blendSSE(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static void castRayPacketSSE(const float* rayAngle, const float* rayDirX, const float* rayDirY, int firstStripId)
+{
+	const int* grid = getMapGrid();
+	int startMapX = (int)(player.x / TILE_SIZE);
+	int startMapY = (int)(player.y / TILE_SIZE);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 dirX = _mm_loadu_ps(rayDirX);
+	__m128 dirY = _mm_loadu_ps(rayDirY);
+	__m128 absDirX = _mm_andnot_ps(signBit, dirX);
+	__m128 absDirY = _mm_andnot_ps(signBit, dirY);
+	__m128 negX = _mm_cmplt_ps(dirX, zero);
+	__m128 negY = _mm_cmplt_ps(dirY, zero);
+
+	__m128 sideDistX = _mm_div_ps(blendSSE(negX,
+		_mm_set1_ps(player.x - startMapX * TILE_SIZE),
+		_mm_set1_ps((startMapX + 1) * TILE_SIZE - player.x)), absDirX);
+	__m128 sideDistY = _mm_div_ps(blendSSE(negY,
+		_mm_set1_ps(player.y - startMapY * TILE_SIZE),
+		_mm_set1_ps((startMapY + 1) * TILE_SIZE - player.y)), absDirY);
+	__m128 deltaDistX = _mm_div_ps(_mm_set1_ps(TILE_SIZE), absDirX);
+	__m128 deltaDistY = _mm_div_ps(_mm_set1_ps(TILE_SIZE), absDirY);
+
+	__m128i one = _mm_set1_epi32(1);
+	__m128i stepX = _mm_or_si128(_mm_castps_si128(negX), one);
+	__m128i stepY = _mm_or_si128(_mm_castps_si128(negY), one);
+	__m128i mapX = _mm_set1_epi32(startMapX);
+	__m128i mapY = _mm_set1_epi32(startMapY);
+
+	__m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	__m128 distance = zero;
+	__m128 vertical = zero;
+	__m128i content = _mm_setzero_si128();
+
+	while (_mm_movemask_ps(active) != 0)
+	{
+		__m128 alongX = _mm_cmplt_ps(sideDistX, sideDistY);
+		__m128 takeX = _mm_and_ps(active, alongX);
+		__m128 takeY = _mm_andnot_ps(alongX, active);
+
+		distance = blendSSE(takeX, sideDistX, distance);
+		distance = blendSSE(takeY, sideDistY, distance);
+		sideDistX = blendSSE(takeX, _mm_add_ps(sideDistX, deltaDistX), sideDistX);
+		sideDistY = blendSSE(takeY, _mm_add_ps(sideDistY, deltaDistY), sideDistY);
+		mapX = _mm_add_epi32(mapX, _mm_and_si128(_mm_castps_si128(takeX), stepX));
+		mapY = _mm_add_epi32(mapY, _mm_and_si128(_mm_castps_si128(takeY), stepY));
+		vertical = blendSSE(active, alongX, vertical);
+
+		// SSE2 has no gather, so the cell lookup is done per active lane.
+		int laneMapX[4], laneMapY[4], laneCell[4];
+		int activeMask = _mm_movemask_ps(active);
+		_mm_storeu_si128((__m128i*)laneMapX, mapX);
+		_mm_storeu_si128((__m128i*)laneMapY, mapY);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			laneCell[lane] = 0;
+			if (!(activeMask & (1 << lane)))
+				continue;
+			if (laneMapX[lane] < 0 || laneMapX[lane] >= MAP_NUM_COLS || laneMapY[lane] < 0 || laneMapY[lane] >= MAP_NUM_ROWS)
+			{
+				activeMask &= ~(1 << lane);
+				continue;
+			}
+			laneCell[lane] = grid[laneMapY[lane] * MAP_NUM_COLS + laneMapX[lane]];
+			if (laneCell[lane] != 0)
+				activeMask &= ~(1 << lane);
+		}
+		content = _mm_or_si128(content, _mm_loadu_si128((const __m128i*)laneCell));
+		active = _mm_castsi128_ps(_mm_set_epi32(
+			(activeMask & 8) ? -1 : 0, (activeMask & 4) ? -1 : 0,
+			(activeMask & 2) ? -1 : 0, (activeMask & 1) ? -1 : 0));
+	}
+
+	__m128 wallHitX = _mm_add_ps(_mm_set1_ps(player.x), _mm_mul_ps(distance, dirX));
+	__m128 wallHitY = _mm_add_ps(_mm_set1_ps(player.y), _mm_mul_ps(distance, dirY));
+	__m128 missed = _mm_castsi128_ps(_mm_cmpeq_epi32(content, _mm_setzero_si128()));
+	// Hits are inside the map, so the coordinate is non-negative and % TILE_SIZE is a mask.
+	__m128i wallHitOffset = _mm_and_si128(_mm_cvttps_epi32(blendSSE(vertical, wallHitY, wallHitX)), _mm_set1_epi32(TILE_SIZE - 1));
+
+	_mm_storeu_ps(&rays.rayAngle[firstStripId], _mm_loadu_ps(rayAngle));
+	_mm_storeu_ps(&rays.distance[firstStripId], blendSSE(missed, _mm_set1_ps(FLT_MAX), distance));
+	_mm_storeu_ps(&rays.wallHitX[firstStripId], wallHitX);
+	_mm_storeu_ps(&rays.wallHitY[firstStripId], wallHitY);
+	_mm_storeu_si128((__m128i*)&rays.wallHitOffset[firstStripId], wallHitOffset);
+	_mm_storeu_si128((__m128i*)&rays.wallHitContent[firstStripId], content);
+	storeWasHitVertical(firstStripId, 4, _mm_movemask_ps(vertical));
+}
+
+__attribute__((target("avx2")))
+static void castRayPacketAVX2(const float* rayAngle, const float* rayDirX, const float* rayDirY, int firstStripId)
+{
+	const int* grid = getMapGrid();
+	int startMapX = (int)(player.x / TILE_SIZE);
+	int startMapY = (int)(player.y / TILE_SIZE);
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 signBit = _mm256_set1_ps(-0.0f);
+	__m256 dirX = _mm256_loadu_ps(rayDirX);
+	__m256 dirY = _mm256_loadu_ps(rayDirY);
+	__m256 absDirX = _mm256_andnot_ps(signBit, dirX);
+	__m256 absDirY = _mm256_andnot_ps(signBit, dirY);
+	__m256 negX = _mm256_cmp_ps(dirX, zero, _CMP_LT_OQ);
+	__m256 negY = _mm256_cmp_ps(dirY, zero, _CMP_LT_OQ);
+
+	__m256 sideDistX = _mm256_div_ps(_mm256_blendv_ps(
+		_mm256_set1_ps((startMapX + 1) * TILE_SIZE - player.x),
+		_mm256_set1_ps(player.x - startMapX * TILE_SIZE), negX), absDirX);
+	__m256 sideDistY = _mm256_div_ps(_mm256_blendv_ps(
+		_mm256_set1_ps((startMapY + 1) * TILE_SIZE - player.y),
+		_mm256_set1_ps(player.y - startMapY * TILE_SIZE), negY), absDirY);
+	__m256 deltaDistX = _mm256_div_ps(_mm256_set1_ps(TILE_SIZE), absDirX);
+	__m256 deltaDistY = _mm256_div_ps(_mm256_set1_ps(TILE_SIZE), absDirY);
+
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i stepX = _mm256_or_si256(_mm256_castps_si256(negX), one);
+	__m256i stepY = _mm256_or_si256(_mm256_castps_si256(negY), one);
+	__m256i mapX = _mm256_set1_epi32(startMapX);
+	__m256i mapY = _mm256_set1_epi32(startMapY);
+	__m256i numCols = _mm256_set1_epi32(MAP_NUM_COLS);
+	__m256i numRows = _mm256_set1_epi32(MAP_NUM_ROWS);
+	__m256i zeroInt = _mm256_setzero_si256();
+
+	__m256i active = _mm256_set1_epi32(-1);
+	__m256 distance = zero;
+	__m256 vertical = zero;
+	__m256i content = zeroInt;
+
+	while (!_mm256_testz_si256(active, active))
+	{
+		__m256 activeMask = _mm256_castsi256_ps(active);
+		__m256 alongX = _mm256_cmp_ps(sideDistX, sideDistY, _CMP_LT_OQ);
+		__m256 takeX = _mm256_and_ps(activeMask, alongX);
+		__m256 takeY = _mm256_andnot_ps(alongX, activeMask);
+
+		distance = _mm256_blendv_ps(distance, sideDistX, takeX);
+		distance = _mm256_blendv_ps(distance, sideDistY, takeY);
+		sideDistX = _mm256_blendv_ps(sideDistX, _mm256_add_ps(sideDistX, deltaDistX), takeX);
+		sideDistY = _mm256_blendv_ps(sideDistY, _mm256_add_ps(sideDistY, deltaDistY), takeY);
+		mapX = _mm256_add_epi32(mapX, _mm256_and_si256(_mm256_castps_si256(takeX), stepX));
+		mapY = _mm256_add_epi32(mapY, _mm256_and_si256(_mm256_castps_si256(takeY), stepY));
+		vertical = _mm256_blendv_ps(vertical, alongX, activeMask);
+
+		// Lanes that stepped outside the grid finish with content 0.
+		__m256i inside = _mm256_and_si256(
+			_mm256_and_si256(_mm256_cmpgt_epi32(mapX, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(numCols, mapX)),
+			_mm256_and_si256(_mm256_cmpgt_epi32(mapY, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(numRows, mapY)));
+		__m256i lookup = _mm256_and_si256(active, inside);
+		__m256i index = _mm256_add_epi32(_mm256_mullo_epi32(mapY, numCols), mapX);
+		__m256i cell = _mm256_mask_i32gather_epi32(zeroInt, grid, index, lookup, 4);
+
+		content = _mm256_or_si256(content, cell);
+		active = _mm256_and_si256(lookup, _mm256_cmpeq_epi32(cell, zeroInt));
+	}
+
+	__m256 wallHitX = _mm256_add_ps(_mm256_set1_ps(player.x), _mm256_mul_ps(distance, dirX));
+	__m256 wallHitY = _mm256_add_ps(_mm256_set1_ps(player.y), _mm256_mul_ps(distance, dirY));
+	__m256 missed = _mm256_castsi256_ps(_mm256_cmpeq_epi32(content, zeroInt));
+	__m256i wallHitOffset = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_blendv_ps(wallHitX, wallHitY, vertical)), _mm256_set1_epi32(TILE_SIZE - 1));
+
+	_mm256_storeu_ps(&rays.rayAngle[firstStripId], _mm256_loadu_ps(rayAngle));
+	_mm256_storeu_ps(&rays.distance[firstStripId], _mm256_blendv_ps(distance, _mm256_set1_ps(FLT_MAX), missed));
+	_mm256_storeu_ps(&rays.wallHitX[firstStripId], wallHitX);
+	_mm256_storeu_ps(&rays.wallHitY[firstStripId], wallHitY);
+	_mm256_storeu_si256((__m256i*)&rays.wallHitOffset[firstStripId], wallHitOffset);
+	_mm256_storeu_si256((__m256i*)&rays.wallHitContent[firstStripId], content);
+	storeWasHitVertical(firstStripId, 8, _mm256_movemask_ps(vertical));
+}
+
+#endif
+
+// Returns the packet width of the chosen kernel; 1 means traceRay() is used for every column.
+int selectRayPacketCaster(ray_caster_t caster, ray_packet_fn_t* castPacket)
+{
+	*castPacket = NULL;
+#ifdef HAVE_X86_RAY_PACKETS
+	__builtin_cpu_init();
+	bool hasAVX2 = __builtin_cpu_supports("avx2");
+
+	if ((caster == RAY_CASTER_AUTO || caster == RAY_CASTER_AVX2) && hasAVX2)
+	{
+		*castPacket = castRayPacketAVX2;
+		return 8;
+	}
+	if (caster == RAY_CASTER_AUTO || caster == RAY_CASTER_SSE || caster == RAY_CASTER_AVX2)
+	{
+		*castPacket = castRayPacketSSE;
+		return 4;
+	}
+#else
+	(void)caster;
+#endif
+	return 1;
+}
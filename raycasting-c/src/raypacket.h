@@ -0,0 +1,14 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include "config.h"
+
+#define MAX_RAY_PACKET_WIDTH 8
+
+// Casts one packet of adjacent columns starting at firstStripId. Angles must be
+// normalized; directions are their cos / sin.
+typedef void (*ray_packet_fn_t)(const float* rayAngle, const float* rayDirX, const float* rayDirY, int firstStripId);
+
+int selectRayPacketCaster(ray_caster_t caster, ray_packet_fn_t* castPacket);
+
+#endif
@@ -0,0 +1,55 @@
+#include "scheduler.h"
+
+static struct {
+	uint64_t tickNs;
+	uint64_t frameNs;       // 0 leaves the frame rate uncapped
+	uint64_t lastNs;
+	uint64_t accumulatorNs; // time not yet simulated, always under one tick after advanceScheduler()
+	uint64_t nextFrameNs;
+} scheduler;
+
+void initializeScheduler(int tickRate, int frameRate, uint64_t nowNs)
+{
+	scheduler.tickNs = 1000000000ull / (tickRate > 0 ? tickRate : 1);
+	scheduler.frameNs = frameRate > 0 ? 1000000000ull / frameRate : 0;
+	scheduler.lastNs = nowNs;
+	scheduler.accumulatorNs = 0;
+	scheduler.nextFrameNs = nowNs;
+}
+
+float getTickSeconds()
+{
+	return scheduler.tickNs / 1e9f;
+}
+
+// Time left before the next frame may start under the frame rate cap.
+uint64_t getFrameWaitNs(uint64_t nowNs)
+{
+	return scheduler.nextFrameNs > nowNs ? scheduler.nextFrameNs - nowNs : 0;
+}
+
+// Starts a frame at nowNs: returns the ticks to simulate and sets alpha to how far
+// the frame lies between the last two of them, for interpolating what is drawn.
+int advanceScheduler(uint64_t nowNs, float* alpha)
+{
+	// deadlines advance by whole frames so waiting does not drift, unless a frame
+	// ran so long that catching up would mean starting the next ones back to back
+	if (scheduler.frameNs > 0)
+	{
+		scheduler.nextFrameNs += scheduler.frameNs;
+		if (scheduler.nextFrameNs < nowNs)
+			scheduler.nextFrameNs = nowNs + scheduler.frameNs;
+	}
+
+	scheduler.accumulatorNs += nowNs - scheduler.lastNs;
+	scheduler.lastNs = nowNs;
+	uint64_t ticks = scheduler.accumulatorNs / scheduler.tickNs;
+	if (ticks > MAX_TICKS_PER_FRAME)
+	{
+		ticks = MAX_TICKS_PER_FRAME;
+		scheduler.accumulatorNs = ticks * scheduler.tickNs;
+	}
+	scheduler.accumulatorNs -= ticks * scheduler.tickNs;
+	*alpha = (float)scheduler.accumulatorNs / scheduler.tickNs;
+	return (int)ticks;
+}
@@ -0,0 +1,17 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+// A long stall runs at most this many ticks in one frame and drops the rest of the
+// backlog, so the simulation cannot fall further behind by trying to catch up.
+#define MAX_TICKS_PER_FRAME 8
+
+// Fixed-step simulation clock, decoupled from the frame rate. Times come from the
+// caller's clock in nanoseconds so the same schedule can be replayed headless.
+void initializeScheduler(int tickRate, int frameRate, uint64_t nowNs);
+float getTickSeconds(void);
+uint64_t getFrameWaitNs(uint64_t nowNs);
+int advanceScheduler(uint64_t nowNs, float* alpha);
+
+#endif
@@ -0,0 +1,26 @@
+#include "shading.h"
+
+shading_t shading = {
+	.numFogLevels = 0,
+	.numShades = 0,
+};
+
+// Fog level f keeps 1 - f / numFogLevels of the light, so one level means no fog.
+void initializeShading(int numFogLevels)
+{
+	if (numFogLevels < 1)
+		numFogLevels = 1;
+	if (numFogLevels > MAX_FOG_LEVELS)
+		numFogLevels = MAX_FOG_LEVELS;
+	shading.numFogLevels = numFogLevels;
+	shading.numShades = numFogLevels * 2;
+
+	for (int shade = 0; shade < shading.numShades; shade++)
+	{
+		float intensity = 1.0f - (float)(shade / 2) / numFogLevels;
+		if (shade % 2 == 1)
+			intensity *= VERTICAL_HIT_INTENSITY;
+		for (int v = 0; v < 256; v++)
+			shading.intensityTable[shade][v] = (uint8_t)(v * intensity);
+	}
+}
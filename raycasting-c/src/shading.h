@@ -0,0 +1,43 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "defs.h"
+
+#define MAX_FOG_LEVELS 16
+// Each fog level has a lit and a vertical-hit (darker side) shade.
+#define MAX_SHADES (MAX_FOG_LEVELS * 2)
+#define VERTICAL_HIT_INTENSITY 0.7f
+// Distance at which walls reach the darkest fog level.
+#define FOG_DISTANCE (8 * TILE_SIZE)
+
+// Shade s scales each color channel v to intensityTable[s][v]; shade 0 leaves colors unchanged.
+typedef struct {
+	int numFogLevels;
+	int numShades;
+	uint8_t intensityTable[MAX_SHADES][256];
+} shading_t;
+
+extern shading_t shading;
+
+void initializeShading(int numFogLevels);
+
+static inline int getWallShade(float perpDistance, bool wasHitVertical)
+{
+	int fogLevel = (int)(perpDistance * shading.numFogLevels / FOG_DISTANCE);
+	if (fogLevel >= shading.numFogLevels)
+		fogLevel = shading.numFogLevels - 1;
+	return fogLevel * 2 + (wasHitVertical ? 1 : 0);
+}
+
+static inline color_t shadeColor(color_t color, int shade)
+{
+	const uint8_t* table = shading.intensityTable[shade];
+	return (color & 0xFF000000)
+		| ((color_t)table[(color >> 16) & 0xFF] << 16)
+		| ((color_t)table[(color >> 8) & 0xFF] << 8)
+		| (color_t)table[color & 0xFF];
+}
+
+#endif
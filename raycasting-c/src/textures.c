@@ -1,6 +1,9 @@
 #include "textures.h"
+#include "memory.h"
 #include <stdio.h>
 
+texture_t wallTextures[NUM_TEXTURES];
+
 static const char* textureFileNames[NUM_TEXTURES] = {
     "./images/redbrick.png",
     "./images/purplestone.png",
@@ -13,26 +16,189 @@ static const char* textureFileNames[NUM_TEXTURES] = {
     "./images/pikuma.png"
 };
 
-void loadWallTextures() {
-    for (int i = 0; i < NUM_TEXTURES; i++) {
-        upng_t* upng;
-
-        upng = upng_new_from_file(textureFileNames[i]);
-        if (upng != NULL) {
-            upng_decode(upng);
-            if (upng_get_error(upng) == UPNG_EOK) {
-                wallTextures[i].upngTexture = upng;
-                wallTextures[i].width = upng_get_width(upng);
-                wallTextures[i].height = upng_get_height(upng);
-                wallTextures[i].texture_buffer = (color_t*)upng_get_buffer(upng);
+// Column-major copy so that a wall strip, which walks down one texture column,
+// reads contiguous memory instead of jumping a full row per texel.
+static color_t* transposeTexture(const color_t* buffer, int width, int height) {
+    color_t* columns = (color_t*)alignedAlloc(sizeof(color_t) * width * height);
+    if (columns == NULL)
+        return NULL;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            columns[x * height + y] = buffer[y * width + x];
+    return columns;
+}
+
+// Averages each 2x2 block per channel (a 1-texel edge is averaged with itself).
+static color_t* downsampleTexture(const color_t* buffer, int width, int height, int mipWidth, int mipHeight) {
+    color_t* mip = (color_t*)alignedAlloc(sizeof(color_t) * mipWidth * mipHeight);
+    if (mip == NULL)
+        return NULL;
+    for (int y = 0; y < mipHeight; y++) {
+        int y0 = y * 2;
+        int y1 = y0 + 1 < height ? y0 + 1 : y0;
+        for (int x = 0; x < mipWidth; x++) {
+            int x0 = x * 2;
+            int x1 = x0 + 1 < width ? x0 + 1 : x0;
+            color_t texels[4] = {
+                buffer[y0 * width + x0], buffer[y0 * width + x1],
+                buffer[y1 * width + x0], buffer[y1 * width + x1]
+            };
+            color_t color = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                color_t sum = 2;
+                for (int i = 0; i < 4; i++)
+                    sum += (texels[i] >> shift) & 0xFF;
+                color |= (sum / 4) << shift;
+            }
+            mip[y * mipWidth + x] = color;
+        }
+    }
+    return mip;
+}
+
+// Fills texture->mips from the decoded row-major image, in the texture's layout.
+static bool buildMipChain(texture_t* texture, bool mipmaps) {
+    // Row-major copy of the current level; with the column layout the levels above 0
+    // are temporaries, freed once the next level has been downsampled from them.
+    color_t* rowLevel = texture->texture_buffer;
+    int width = texture->width;
+    int height = texture->height;
+
+    texture->numMipLevels = 0;
+    for (int level = 0; level < MAX_MIP_LEVELS; level++) {
+        if (level > 0) {
+            int mipWidth = width > 1 ? width / 2 : 1;
+            int mipHeight = height > 1 ? height / 2 : 1;
+            color_t* nextLevel = downsampleTexture(rowLevel, width, height, mipWidth, mipHeight);
+            if (texture->columnMajor && rowLevel != texture->texture_buffer)
+                alignedFree(rowLevel);
+            rowLevel = nextLevel;
+            if (rowLevel == NULL)
+                break;
+            width = mipWidth;
+            height = mipHeight;
+        }
+
+        texture_mip_t* mip = &texture->mips[level];
+        mip->width = width;
+        mip->height = height;
+        mip->buffer = texture->columnMajor ? transposeTexture(rowLevel, width, height) : rowLevel;
+        if (mip->buffer == NULL)
+            break;
+        texture->numMipLevels++;
+        if (!mipmaps || (width == 1 && height == 1))
+            break;
+    }
+    if (texture->columnMajor && rowLevel != texture->texture_buffer)
+        alignedFree(rowLevel);
+    // running out of memory part way only shortens the chain
+    return texture->numMipLevels > 0;
+}
+
+// Bakes every mip level in shades 1 .. numShades - 1 through the shading tables,
+// so the wall pass only picks a buffer per column instead of shading each texel.
+static void bakeShades(texture_t* texture, int numShades) {
+    texture->numShades = 1;
+    for (int level = 0; level < texture->numMipLevels; level++)
+        texture->mips[level].shades[0] = texture->mips[level].buffer;
+    for (int shade = 1; shade < numShades; shade++) {
+        for (int level = 0; level < texture->numMipLevels; level++) {
+            texture_mip_t* mip = &texture->mips[level];
+            int size = mip->width * mip->height;
+            mip->shades[shade] = (color_t*)alignedAlloc(sizeof(color_t) * size);
+            if (mip->shades[shade] == NULL) {
+                // the levels that got this shade are freed with the chain; the LUT covers the rest
+                fprintf(stderr, "Error allocating shaded texture, falling back to per-pixel shading.\n");
+                return;
             }
+            for (int i = 0; i < size; i++)
+                mip->shades[shade][i] = shadeColor(mip->buffer[i], shade);
         }
+        texture->numShades++;
     }
+}
 
+static void freeMipChain(texture_t* texture) {
+    for (int level = 0; level < texture->numMipLevels; level++) {
+        for (int shade = 1; shade < MAX_SHADES; shade++) {
+            alignedFree(texture->mips[level].shades[shade]);
+            texture->mips[level].shades[shade] = NULL;
+        }
+        if (level > 0 || texture->columnMajor)
+            alignedFree(texture->mips[level].buffer);
+        texture->mips[level].buffer = NULL;
+        texture->mips[level].shades[0] = NULL;
+    }
+    texture->numMipLevels = 0;
+    texture->numShades = 0;
+}
+
+// Decodes straight into cache-line aligned storage the texture owns, inflating through a
+// scratch buffer shared by every texture, so no upng_t or file contents outlive the load.
+static color_t* decodeTexture(const char* fileName, int* width, int* height, unsigned char** scratch, unsigned long* scratchSize) {
+    upng_t* upng = upng_new_from_file(fileName);
+    if (upng == NULL)
+        return NULL;
+    if (upng_header(upng) != UPNG_EOK) {
+        upng_free(upng);
+        return NULL;
+    }
+    // texels are read as color_t, and smaller pixel formats would decode into the buffer without error
+    if (upng_get_format(upng) != UPNG_RGBA8) {
+        fprintf(stderr, "Error loading %s: only RGBA8 textures are supported.\n", fileName);
+        upng_free(upng);
+        return NULL;
+    }
+
+    *width = upng_get_width(upng);
+    *height = upng_get_height(upng);
+    unsigned long size = sizeof(color_t) * *width * *height;
+    if (upng_get_scratch_size(upng) > *scratchSize) {
+        alignedFree(*scratch);
+        *scratchSize = upng_get_scratch_size(upng);
+        *scratch = (unsigned char*)alignedAlloc(*scratchSize);
+        if (*scratch == NULL)
+            *scratchSize = 0;
+    }
+    color_t* buffer = (color_t*)alignedAlloc(size);
+    if (buffer != NULL && upng_decode_into(upng, (unsigned char*)buffer, size, *scratch, *scratchSize) != UPNG_EOK) {
+        alignedFree(buffer);
+        buffer = NULL;
+    }
+    upng_free(upng);
+    return buffer;
+}
+
+void loadWallTextures(texture_layout_t layout, bool mipmaps, int numShades) {
+    unsigned char* scratch = NULL;
+    unsigned long scratchSize = 0;
+    for (int i = 0; i < NUM_TEXTURES; i++) {
+        texture_t* texture = &wallTextures[i];
+        texture->texture_buffer = decodeTexture(textureFileNames[i], &texture->width, &texture->height, &scratch, &scratchSize);
+        if (texture->texture_buffer == NULL)
+            continue;
+        texture->columnMajor = layout == TEXTURE_LAYOUT_COLUMN;
+        if (!buildMipChain(texture, mipmaps)) {
+            fprintf(stderr, "Error building mip chain for %s.\n", textureFileNames[i]);
+            freeMipChain(texture);
+            alignedFree(texture->texture_buffer);
+            texture->texture_buffer = NULL;
+            continue;
+        }
+        // the column-major chain holds its own copy of level 0
+        if (texture->columnMajor) {
+            alignedFree(texture->texture_buffer);
+            texture->texture_buffer = NULL;
+        }
+        bakeShades(texture, numShades);
+    }
+    alignedFree(scratch);
 }
 
 void freeWallTextures() {
     for (int i = 0; i < NUM_TEXTURES; i++) {
-        upng_free(wallTextures[i].upngTexture);
+        freeMipChain(&wallTextures[i]);
+        alignedFree(wallTextures[i].texture_buffer);
+        wallTextures[i].texture_buffer = NULL;
     }
 }
@@ -1,20 +1,60 @@
 #ifndef TEXTURES_H
 #define TEXTURES_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "defs.h"
+#include "config.h"
+#include "shading.h"
 #include "upng.h"
 
+#define MAX_MIP_LEVELS 16
+
+// One level of a texture's mip chain, stored in the texture's layout.
 typedef struct {
-    upng_t* upngTexture;
     int width;
     int height;
-    color_t* texture_buffer;
+    color_t* buffer;
+    color_t* shades[MAX_SHADES]; // pre-shaded copies of buffer, shades[0] is buffer itself
+} texture_mip_t;
+
+typedef struct {
+    int width;
+    int height;
+    color_t* texture_buffer;  // row-major, as decoded by upng; level 0 of a row-major chain, NULL once a column-major chain is built
+    bool columnMajor;
+    int numMipLevels;
+    int numShades;              // baked shades per level, 1 when shading goes through the LUT
+    texture_mip_t mips[MAX_MIP_LEVELS]; // level 0 is the full-size texture
 } texture_t;
 
-texture_t wallTextures[NUM_TEXTURES];
+extern texture_t wallTextures[NUM_TEXTURES];
 
-void loadWallTextures(void);
+void loadWallTextures(texture_layout_t layout, bool mipmaps, int numShades);
 void freeWallTextures(void);
 
+// Largest level whose height still covers stripHeight screen pixels, so that
+// each pixel steps through at most about one texel.
+static inline int selectMipLevel(const texture_t* texture, int stripHeight)
+{
+    int level = 0;
+    while (level + 1 < texture->numMipLevels && texture->mips[level + 1].height >= stripHeight)
+        level++;
+    return level;
+}
+
+// Texels of column x of a mip level in a baked shade (< numShades) from top to bottom
+// are column[0], column[stride], ...
+static inline const color_t* getTextureColumn(const texture_t* texture, int level, int shade, int x, int* stride)
+{
+    const texture_mip_t* mip = &texture->mips[level];
+    if (texture->columnMajor) {
+        *stride = 1;
+        return mip->shades[shade] + x * mip->height;
+    }
+    *stride = mip->width;
+    return mip->shades[shade] + x;
+}
+
 #endif
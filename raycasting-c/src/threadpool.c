@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "threadpool.h"
+#include "memory.h"
+#include "timer.h"
+
+// More bands than threads so that threads finishing cheap bands early pick up more work.
+#define BANDS_PER_THREAD 4
+
+// One cache line per thread so that threads updating their own timings do not share lines.
+typedef union {
+	thread_timing_t timing;
+	char padding[CACHE_LINE_SIZE];
+} thread_slot_t;
+
+static struct {
+	pthread_t* workers;
+	thread_slot_t* slots;
+	int numThreads; // including the calling thread
+	pthread_mutex_t mutex;
+	pthread_cond_t workReady;
+	pthread_cond_t workDone;
+	unsigned generation;
+	bool shuttingDown;
+	int activeWorkers;
+
+	parallel_job_t job;
+	void* context;
+	int count;
+	int numBands;
+	int nextBand;
+} pool = {
+	.workers = NULL,
+	.slots = NULL,
+	.numThreads = 1,
+};
+
+static void runBands(int thread)
+{
+	thread_timing_t* timing = &pool.slots[thread].timing;
+	uint64_t start = getTimeNanoseconds();
+	int band;
+	while ((band = __sync_fetch_and_add(&pool.nextBand, 1)) < pool.numBands)
+	{
+		int begin = (int)((long long)pool.count * band / pool.numBands);
+		int end = (int)((long long)pool.count * (band + 1) / pool.numBands);
+		pool.job(pool.context, begin, end);
+		timing->bands++;
+	}
+	timing->busyNs += getTimeNanoseconds() - start;
+}
+
+static void* workerMain(void* arg)
+{
+	unsigned seenGeneration = 0;
+	int thread = (int)(intptr_t)arg;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&pool.mutex);
+		while (pool.generation == seenGeneration && !pool.shuttingDown)
+			pthread_cond_wait(&pool.workReady, &pool.mutex);
+		if (pool.shuttingDown)
+		{
+			pthread_mutex_unlock(&pool.mutex);
+			return NULL;
+		}
+		seenGeneration = pool.generation;
+		pthread_mutex_unlock(&pool.mutex);
+
+		runBands(thread);
+
+		pthread_mutex_lock(&pool.mutex);
+		if (--pool.activeWorkers == 0)
+			pthread_cond_signal(&pool.workDone);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+}
+
+bool initializeThreadPool(int numThreads)
+{
+	if (numThreads <= 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		numThreads = cores > 0 ? (int)cores : 1;
+	}
+
+	pool.numThreads = 1;
+	pool.generation = 0;
+	pool.shuttingDown = false;
+	pool.slots = (thread_slot_t*)alignedAlloc(sizeof(thread_slot_t) * numThreads);
+	if (!pool.slots)
+	{
+		fprintf(stderr, "Error allocating thread pool.\n");
+		return false;
+	}
+	memset(pool.slots, 0, sizeof(thread_slot_t) * numThreads);
+	if (numThreads == 1)
+		return true;
+
+	pool.workers = (pthread_t*)malloc(sizeof(pthread_t) * (numThreads - 1));
+	if (!pool.workers)
+	{
+		fprintf(stderr, "Error allocating thread pool.\n");
+		return false;
+	}
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.workReady, NULL);
+	pthread_cond_init(&pool.workDone, NULL);
+
+	for (int i = 0; i < numThreads - 1; i++)
+	{
+		if (pthread_create(&pool.workers[i], NULL, workerMain, (void*)(intptr_t)(i + 1)) != 0)
+		{
+			fprintf(stderr, "Error creating worker thread, continuing with %d threads.\n", pool.numThreads);
+			break;
+		}
+		pool.numThreads++;
+	}
+	return true;
+}
+
+void destroyThreadPool()
+{
+	if (pool.workers)
+	{
+		pthread_mutex_lock(&pool.mutex);
+		pool.shuttingDown = true;
+		pthread_cond_broadcast(&pool.workReady);
+		pthread_mutex_unlock(&pool.mutex);
+
+		for (int i = 0; i < pool.numThreads - 1; i++)
+			pthread_join(pool.workers[i], NULL);
+
+		pthread_cond_destroy(&pool.workDone);
+		pthread_cond_destroy(&pool.workReady);
+		pthread_mutex_destroy(&pool.mutex);
+		free(pool.workers);
+		pool.workers = NULL;
+	}
+	alignedFree(pool.slots);
+	pool.slots = NULL;
+	pool.numThreads = 1;
+}
+
+int getThreadPoolSize()
+{
+	return pool.numThreads;
+}
+
+// Splits [0, count) into bands and runs them on the pool; the calling thread works too.
+void parallelFor(int count, parallel_job_t job, void* context)
+{
+	if (pool.numThreads == 1 || count <= 1)
+	{
+		uint64_t start = getTimeNanoseconds();
+		job(context, 0, count);
+		if (pool.slots)
+		{
+			pool.slots[0].timing.busyNs += getTimeNanoseconds() - start;
+			pool.slots[0].timing.bands++;
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.job = job;
+	pool.context = context;
+	pool.count = count;
+	pool.numBands = pool.numThreads * BANDS_PER_THREAD;
+	if (pool.numBands > count)
+		pool.numBands = count;
+	pool.nextBand = 0;
+	pool.activeWorkers = pool.numThreads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.workReady);
+	pthread_mutex_unlock(&pool.mutex);
+
+	runBands(0);
+
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.activeWorkers > 0)
+		pthread_cond_wait(&pool.workDone, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void resetThreadPoolTimings()
+{
+	if (!pool.slots)
+		return;
+	for (int i = 0; i < pool.numThreads; i++)
+	{
+		pool.slots[i].timing.busyNs = 0;
+		pool.slots[i].timing.bands = 0;
+	}
+}
+
+// Only meaningful between parallelFor calls, when every worker is idle.
+void getThreadPoolTimings(thread_timing_t* timings)
+{
+	for (int i = 0; i < pool.numThreads; i++)
+		timings[i] = pool.slots[i].timing;
+}
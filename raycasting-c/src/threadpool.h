@@ -0,0 +1,23 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Work done by one thread since the last resetThreadPoolTimings(); thread 0 is the caller of parallelFor.
+typedef struct {
+	uint64_t busyNs;
+	int bands;
+} thread_timing_t;
+
+// Called once per band with the half-open range [begin, end).
+typedef void (*parallel_job_t)(void* context, int begin, int end);
+
+bool initializeThreadPool(int numThreads);
+void destroyThreadPool(void);
+int getThreadPoolSize(void);
+void parallelFor(int count, parallel_job_t job, void* context);
+void resetThreadPoolTimings(void);
+void getThreadPoolTimings(thread_timing_t* timings); // getThreadPoolSize() entries
+
+#endif
@@ -0,0 +1,11 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "timer.h"
+
+// Monotonic clock in nanoseconds. Does not depend on SDL so it also works in the headless bench.
+uint64_t getTimeNanoseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
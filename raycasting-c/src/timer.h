@@ -0,0 +1,8 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+uint64_t getTimeNanoseconds(void);
+
+#endif
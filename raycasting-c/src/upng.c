@@ -24,10 +24,30 @@ freely, subject to the following restrictions:
 		distribution.
 */
 
+/* files are memory-mapped where POSIX provides mmap, and read onto the heap elsewhere */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200112L
+#define UPNG_USE_MMAP 1
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+
+/* SSE2/SSSE3/AVX2 unfilter kernels, picked at runtime */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UPNG_X86_UNFILTER 1
+#endif
+
+#if defined(UPNG_USE_MMAP)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "upng.h"
 
@@ -47,15 +67,9 @@ freely, subject to the following restrictions:
 #define NUM_CODE_LENGTH_CODES 19	/*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros */
 #define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
 #define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
 #define upng_chunk_length(chunk) MAKE_DWORD_PTR(chunk)
@@ -76,10 +90,16 @@ typedef enum upng_color {
 	UPNG_RGBA		= 6
 } upng_color;
 
+typedef enum upng_source_owner {
+	UPNG_SOURCE_BORROWED	= 0,	/* caller's bytes, left alone */
+	UPNG_SOURCE_HEAP		= 1,	/* file read into a malloc'd copy */
+	UPNG_SOURCE_MAPPED		= 2		/* read-only mapping of the file; decoded in place like caller bytes, only unmapped by upng */
+} upng_source_owner;
+
 typedef struct upng_source {
 	const unsigned char*	buffer;
 	unsigned long			size;
-	char					owning;
+	upng_source_owner		owning;
 } upng_source;
 
 struct upng_t {
@@ -100,12 +120,6 @@ struct upng_t {
 	upng_source		source;
 };
 
-typedef struct huffman_tree {
-	unsigned* tree2d;
-	unsigned maxbitlen;	/*maximum number of bits a single code can get */
-	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
-
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
 	67, 83, 99, 115, 131, 163, 195, 227, 258
@@ -129,204 +143,292 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+/* bit reader over the deflate stream, which is read in place from the payloads of the IDAT chunks in turn:
+   bits are consumed from the bottom of a 64-bit buffer that is refilled a byte at a time at its top */
+typedef struct inflate_stream {
+	const unsigned char* in;	/*payload of the IDAT chunk being read */
+	unsigned long inlength;
+	unsigned long inpos;	/*next byte to move into the bit buffer */
+	const unsigned char* chunk;	/*chunk after that one, where the search for the next IDAT resumes */
+	const unsigned char* end;	/*end of the (already validated) chunk list */
+	uint64_t bitbuf;
+	unsigned bitcount;	/*valid bits in bitbuf */
+	unsigned overrun;	/*zero bytes fed in past the end of the input, at the top of bitbuf */
+} inflate_stream;
+
+static void stream_init(inflate_stream* s, const unsigned char* chunk, const unsigned char* end)
+{
+	s->in = NULL;
+	s->inlength = 0;
+	s->inpos = 0;
+	s->chunk = chunk;
+	s->end = end;
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	s->overrun = 0;
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+/* moves on to the payload of the next IDAT chunk; false at IEND or the end of the chunk list */
+static int stream_next_chunk(inflate_stream* s)
+{
+	while (s->chunk < s->end && upng_chunk_type(s->chunk) != CHUNK_IEND) {
+		const unsigned char* chunk = s->chunk;
+		s->chunk += upng_chunk_length(chunk) + 12;
+		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
+			s->in = chunk + 8;
+			s->inlength = upng_chunk_length(chunk);
+			s->inpos = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static uint64_t load_le64(const unsigned char* p)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+		| ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+/* tops the bit buffer up to at least 56 bits; past the end of the input it is padded with zero bytes, which stream_overrun() catches once they get consumed */
+static void stream_refill(inflate_stream* s)
 {
-	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+	if (s->inpos + 8 <= s->inlength) {
+		/* load a whole word and keep the bytes that fit; the rest are loaded again next time */
+		s->bitbuf |= load_le64(s->in + s->inpos) << s->bitcount;
+		s->inpos += (63 - s->bitcount) >> 3;
+		s->bitcount |= 56;
+		return;
+	}
+
+	/* near the end of a chunk the bytes may come from the next ones, some of which can be empty */
+	while (s->bitcount <= 56) {
+		while (s->inpos == s->inlength && stream_next_chunk(s)) {
+		}
+		if (s->inpos < s->inlength) {
+			s->bitbuf |= (uint64_t)s->in[s->inpos++] << s->bitcount;
+		} else {
+			s->overrun++;
+		}
+		s->bitcount += 8;
+	}
+}
+
+/* true once bits past the end of the input have been consumed */
+static int stream_overrun(const inflate_stream* s)
+{
+	return s->overrun != 0 && s->bitcount < s->overrun * 8;
+}
+
+/* nbits <= 32, and the buffer must hold them (stream_refill() leaves at least 56) */
+static unsigned stream_take(inflate_stream* s, unsigned nbits)
+{
+	unsigned result = (unsigned)(s->bitbuf & ((1ull << nbits) - 1));
+	s->bitbuf >>= nbits;
+	s->bitcount -= nbits;
 	return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+static unsigned read_bits(inflate_stream* s, unsigned nbits)
+{
+	if (s->bitcount < nbits) {
+		stream_refill(s);
+	}
+	return stream_take(s, nbits);
+}
+
+/*
+   Huffman decoding tables. The first rootbits bits of the stream (which hold the code bit-reversed, as deflate stores it) index the
+   primary table; codes longer than that point to a subtable indexed by the bits that follow. Entries are (symbol << 16) | code length
+   for a symbol, (subtable offset << 16) | HUFFMAN_LINK | subtable index bits for a link, and 0 for a bit pattern no code starts with.
+*/
+#define HUFFMAN_LINK 0x100
+#define HUFFMAN_LENGTH_MASK 0x0F
+
+/* a length code, its extra bits, a distance code and its extra bits */
+#define MAX_LENGTH_DISTANCE_BITS (MAX_BIT_LENGTH + 5 + MAX_BIT_LENGTH + 13)
+
+#define DEFLATE_CODE_ROOT_BITS 9
+#define DISTANCE_ROOT_BITS 7
+#define CODE_LENGTH_ROOT_BITS CODE_LENGTH_BITLEN
+
+/* room for the primary table and the subtables of any code without oversubscribed lengths that real encoders produce */
+#define DEFLATE_CODE_TABLE_SIZE 2048
+#define DISTANCE_TABLE_SIZE 1024
+#define CODE_LENGTH_TABLE_SIZE (1 << CODE_LENGTH_ROOT_BITS)
+
+typedef struct huffman_table {
+	unsigned* entries;
+	unsigned size;	/*capacity of entries */
+	unsigned rootbits;
+	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
+} huffman_table;
+
+static void huffman_table_init(huffman_table* table, unsigned* buffer, unsigned size, unsigned numcodes, unsigned rootbits)
 {
-	tree->tree2d = buffer;
+	table->entries = buffer;
+	table->size = size;
+	table->numcodes = numcodes;
+	table->rootbits = rootbits;
+}
 
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
+static unsigned reverse_bits(unsigned code, unsigned nbits)
+{
+	unsigned result = 0, i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
+	return result;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
+/*given the code lengths (as stored in the PNG file), generate the decoding table for the canonical code as defined by Deflate*/
+static void huffman_table_create_lengths(upng_t* upng, huffman_table* table, const unsigned *bitlen)
 {
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
+	unsigned code[MAX_SYMBOLS];
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned char subbits[1 << DEFLATE_CODE_ROOT_BITS];	/*longest code past rootbits under each root pattern */
+	unsigned rootbits = table->rootbits, rootsize = 1u << rootbits;
+	unsigned used = rootsize;
 	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
+	int left = 1;
 
-	/* initialize local vectors */
 	memset(blcount, 0, sizeof(blcount));
 	memset(nextcode, 0, sizeof(nextcode));
 
-	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+	/*step 1: count number of instances of each code length, and reject more codes than the lengths have room for */
+	for (n = 0; n < table->numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
+	blcount[0] = 0;
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		left = (left << 1) - (int)blcount[bits];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
 	}
 
 	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
+	for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
 		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 	}
 
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
+	/*step 3: generate all the codes, bit-reversed into stream order */
+	for (n = 0; n < table->numcodes; n++) {
 		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+			code[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
 		}
 	}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
+	/*step 4: size a subtable for every root pattern that long codes start with */
+	memset(table->entries, 0, sizeof(unsigned) * rootsize);
+	memset(subbits, 0, sizeof(subbits));
+	for (n = 0; n < table->numcodes; n++) {
+		if (bitlen[n] > rootbits) {
+			unsigned root = code[n] & (rootsize - 1);
+			if (bitlen[n] - rootbits > subbits[root]) {
+				subbits[root] = (unsigned char)(bitlen[n] - rootbits);
+			}
+		}
 	}
-
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
+	for (i = 0; i < rootsize; i++) {
+		if (subbits[i] != 0) {
+			unsigned subsize = 1u << subbits[i];
+			if (used + subsize > table->size) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
-
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-			}
+			memset(table->entries + used, 0, sizeof(unsigned) * subsize);
+			table->entries[i] = (used << 16) | HUFFMAN_LINK | subbits[i];
+			used += subsize;
 		}
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+	/*step 5: fill every entry whose leading bits are a code with that code's symbol */
+	for (n = 0; n < table->numcodes; n++) {
+		unsigned len = bitlen[n];
+		unsigned entry = (n << 16) | len;
+		if (len == 0) {
+			continue;
+		}
+		if (len <= rootbits) {
+			for (i = code[n]; i < rootsize; i += 1u << len) {
+				table->entries[i] = entry;
+			}
+		} else {
+			unsigned link = table->entries[code[n] & (rootsize - 1)];
+			unsigned *sub = table->entries + (link >> 16);
+			unsigned subsize = 1u << (link & HUFFMAN_LENGTH_MASK);
+			for (i = code[n] >> rootbits; i < subsize; i += 1u << (len - rootbits)) {
+				sub[i] = entry;
+			}
 		}
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+static unsigned huffman_decode_symbol(upng_t *upng, inflate_stream* s, const huffman_table* table)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	unsigned entry, len;
 
-		bit = read_bit(bp, in);
+	if (s->bitcount < MAX_BIT_LENGTH) {
+		stream_refill(s);
+	}
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+	entry = table->entries[s->bitbuf & ((1u << table->rootbits) - 1)];
+	if (entry & HUFFMAN_LINK) {
+		unsigned index = (unsigned)(s->bitbuf >> table->rootbits) & ((1u << (entry & HUFFMAN_LENGTH_MASK)) - 1);
+		entry = table->entries[(entry >> 16) + index];
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
-		}
+	/* no code starts with these bits (the code is incomplete) */
+	len = entry & HUFFMAN_LENGTH_MASK;
+	if (len == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
+	}
+	stream_take(s, len);
+
+	/* error: end of input memory reached without endcode */
+	if (stream_overrun(s)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
+
+	return entry >> 16;
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD, huffman_table* codelengthcodetree, inflate_stream* s)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
 	unsigned n, hlit, hdist, hclen, i;
 
-	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
 	/* clear bitlen arrays */
 	memset(bitlen, 0, sizeof(bitlen));
 	memset(bitlenD, 0, sizeof(bitlenD));
 
-	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	hlit = read_bits(s, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = read_bits(s, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = read_bits(s, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(s, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+	/*the bit pointer is or went past the memory */
+	if (stream_overrun(s)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	huffman_table_create_lengths(upng, codelengthcodetree, codelengthcode);
 
 	/* bail now if we encountered an error earlier */
 	if (upng->error != UPNG_EOK) {
@@ -336,7 +438,8 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code = huffman_decode_symbol(upng, s, codelengthcodetree);
+		unsigned replength, value;
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -348,91 +451,44 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 				bitlenD[i - hlit] = code;
 			}
 			i++;
-		} else if (code == 16) {	/*repeat previous */
-			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
-			unsigned value;	/*set value to the previous code */
+			continue;
+		}
 
-			if ((*bp) >> 3 >= inlength) {
+		if (code == 16) {	/*repeat previous 3-6 times */
+			/* there is no previous length to repeat */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
-
-			if ((i - 1) < hlit) {
-				value = bitlen[i - 1];
-			} else {
-				value = bitlenD[i - hlit - 1];
-			}
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = value;
-				} else {
-					bitlenD[i - hlit] = value;
-				}
-				i++;
-			}
+			replength = 3 + read_bits(s, 2);
+			value = (i - 1) < hlit ? bitlen[i - 1] : bitlenD[i - hlit - 1];
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
-			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* error: i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = 0;
-				} else {
-					bitlenD[i - hlit] = 0;
-				}
-				i++;
-			}
+			replength = 3 + read_bits(s, 3);
+			value = 0;
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
-			unsigned replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			replength += read_bits(bp, in, 7);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-				if (i < hlit)
-					bitlen[i] = 0;
-				else
-					bitlenD[i - hlit] = 0;
-				i++;
-			}
+			replength = 11 + read_bits(s, 7);
+			value = 0;
 		} else {
 			/* somehow an unexisting code appeared. This can never happen. */
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			break;
 		}
+
+		/* error, bit pointer jumps past memory, or i is larger than the amount of codes */
+		if (stream_overrun(s) || i + replength > hlit + hdist) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			break;
+		}
+
+		/*repeat this value in the next lengths */
+		for (n = 0; n < replength; n++) {
+			if (i < hlit) {
+				bitlen[i] = value;
+			} else {
+				bitlenD[i - hlit] = value;
+			}
+			i++;
+		}
 	}
 
 	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
@@ -442,48 +498,72 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*the length of the end code 256 must be larger than 0 */
 	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+		huffman_table_create_lengths(upng, codetree, bitlen);
 	}
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_create_lengths(upng, codetreeD, bitlenD);
 	}
 }
 
+/* the fixed codes of btype 1: lengths 8, 9, 7 and 8 for literal/length ranges 0-143, 144-255, 256-279 and 280-287, and 5 for every distance */
+static void get_tree_inflate_fixed(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD)
+{
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned i;
+
+	for (i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) {
+		bitlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	}
+	for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) {
+		bitlenD[i] = 5;
+	}
+
+	huffman_table_create_lengths(upng, codetree, bitlen);
+	huffman_table_create_lengths(upng, codetreeD, bitlenD);
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, inflate_stream* s, unsigned long *pos, unsigned btype)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-	unsigned done = 0;
+	unsigned codetree_buffer[DEFLATE_CODE_TABLE_SIZE];
+	unsigned codetreeD_buffer[DISTANCE_TABLE_SIZE];
+
+	huffman_table codetree;
+	huffman_table codetreeD;
 
-	huffman_tree codetree;
-	huffman_tree codetreeD;
+	huffman_table_init(&codetree, codetree_buffer, DEFLATE_CODE_TABLE_SIZE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_ROOT_BITS);
+	huffman_table_init(&codetreeD, codetreeD_buffer, DISTANCE_TABLE_SIZE, NUM_DISTANCE_SYMBOLS, DISTANCE_ROOT_BITS);
 
 	if (btype == 1) {
 		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		get_tree_inflate_fixed(upng, &codetree, &codetreeD);
 	} else if (btype == 2) {
 		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
+		unsigned codelengthcodetree_buffer[CODE_LENGTH_TABLE_SIZE];
+		huffman_table codelengthcodetree;
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+		huffman_table_init(&codelengthcodetree, codelengthcodetree_buffer, CODE_LENGTH_TABLE_SIZE, NUM_CODE_LENGTH_CODES, CODE_LENGTH_ROOT_BITS);
+		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, s);
+	}
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
-	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+	for (;;) {
+		unsigned code;
+
+		/* enough bits for a whole length/distance pair, so the extra bits below need no refill */
+		if (s->bitcount < MAX_LENGTH_DISTANCE_BITS) {
+			stream_refill(s);
+		}
+
+		code = huffman_decode_symbol(upng, s, &codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
+		if (code <= 255) {
 			/* literal symbol */
 			if ((*pos) >= outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
@@ -492,24 +572,20 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 
 			/* store output */
 			out[(*pos)++] = (unsigned char)(code);
-		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
+		} else if (code == 256) {
+			/* end code */
+			return;
+		} else if (code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
 			/* part 1: get length base */
 			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+			unsigned codeD, distance;
+			unsigned char *dest, *src;
 
 			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
+			length += stream_take(s, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
 
 			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			codeD = huffman_decode_symbol(upng, s, &codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -520,90 +596,94 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				return;
 			}
 
-			distance = DISTANCE_BASE[codeD];
-
 			/*part 4: get extra bits from distance */
-			numextrabitsD = DISTANCE_EXTRA[codeD];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
+			distance = DISTANCE_BASE[codeD] + stream_take(s, DISTANCE_EXTRA[codeD]);
 
-			if ((*pos) + length >= outsize) {
+			/* error, bit pointer jumped past memory, the distance reaches back before the output, or the copy runs past its end */
+			if (stream_overrun(s) || distance > (*pos) || (*pos) + length > outsize) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
-
-				if (backward >= start) {
-					backward = start - distance;
+			/*part 5: fill in all the out[n] values based on the length and dist; a copy that overlaps itself repeats the last distance bytes */
+			dest = out + (*pos);
+			src = dest - distance;
+			(*pos) += length;
+			if (distance >= length) {
+				memcpy(dest, src, length);
+			} else {
+				while (length-- > 0) {
+					*dest++ = *src++;
 				}
 			}
+		} else {
+			/* length codes 286 and 287 are never used */
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, inflate_stream* s, unsigned long *pos)
 {
-	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	stream_take(s, s->bitcount & 0x7);
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	len = read_bits(s, 16);
+	nlen = read_bits(s, 16);
+	if (stream_overrun(s)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	len = in[p] + 256 * in[p + 1];
-	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
-	p += 2;
-
 	/* check if 16-bit nlen is really the one's complement of len */
 	if (len + nlen != 65535) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
+	if ((*pos) + len > outsize) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
+	/* read the literal data: len bytes are now stored in the out buffer, first those already in the bit buffer */
+	while (len > 0 && s->bitcount > s->overrun * 8) {
+		out[(*pos)++] = (unsigned char)stream_take(s, 8);
+		len--;
+	}
+	if (len == 0) {
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
-	}
+	/* then the rest straight from the chunks; the buffer is empty, but may still hold bits of the next byte above bitcount */
+	s->bitbuf = 0;
+	while (len > 0) {
+		unsigned long n;
+		while (s->inpos == s->inlength && stream_next_chunk(s)) {
+		}
 
-	(*bp) = p * 8;
+		/* the data runs past the last IDAT chunk */
+		n = s->inlength - s->inpos;
+		if (n == 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		n = n < len ? n : len;
+		memcpy(out + (*pos), s->in + s->inpos, n);
+		(*pos) += n;
+		s->inpos += n;
+		len -= n;
+	}
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, inflate_stream* s)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
 	unsigned long pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
@@ -611,24 +691,24 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	while (done == 0) {
 		unsigned btype;
 
-		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		/* read block control bits */
+		done = read_bits(s, 1);
+		btype = read_bits(s, 2);
+
+		/* ensure the block header didn't point past the end of the buffer */
+		if (stream_overrun(s)) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
-		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
-
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, out, outsize, s, &pos);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, out, outsize, s, &pos, btype);	/*compression, btype 01 or 10 */
 		}
 
 		/* stop if an error has occured */
@@ -640,34 +720,41 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+/* inflates the zlib stream split across the IDAT chunks from chunk up to end */
+static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *chunk, const unsigned char *end)
 {
+	inflate_stream s;
+	unsigned cmf, flg;
+
+	stream_init(&s, chunk, end);
+	cmf = read_bits(&s, 8);
+	flg = read_bits(&s, 8);
+
 	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
+	if (stream_overrun(&s)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
-	/* 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way */
-	if ((in[0] * 256 + in[1]) % 31 != 0) {
+	/* 256 * cmf + flg must be a multiple of 31, the FCHECK value is supposed to be made that way */
+	if ((cmf * 256 + flg) % 31 != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec */
-	if ((in[0] & 15) != 8 || ((in[0] >> 4) & 15) > 7) {
+	if ((cmf & 15) != 8 || ((cmf >> 4) & 15) > 7) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary." */
-	if (((in[1] >> 5) & 1) != 0) {
+	if (((flg >> 5) & 1) != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
-	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, out, outsize, &s);
 
 	return upng->error;
 }
@@ -750,7 +837,226 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	}
 }
 
-static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
+/*
+   Vectorized unfiltering. Up has no dependency between bytes and runs 16 or 32 bytes at a time for any pixel size; Sub, Average and
+   Paeth depend on the pixel to the left, so for 3- and 4-byte pixels they run a pixel per step with all its bytes in one register
+   (Sub on 4-byte pixels also takes 4 pixels per step as a prefix sum). Every kernel gives the same bytes as unfilter_scanline(), and
+   like it allows recon to start at or before scanline in the same buffer; precon must be disjoint and is never NULL here.
+*/
+typedef void (*unfilter_kernel)(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length);
+
+typedef struct unfilter_kernels {
+	unfilter_kernel sub;	/*NULL where the scalar code handles the filter type */
+	unfilter_kernel up;
+	unfilter_kernel average;
+	unfilter_kernel paeth;
+} unfilter_kernels;
+
+#if defined(UPNG_X86_UNFILTER)
+
+__attribute__((target("sse2")))
+static __m128i load_pixel(const unsigned char *p, unsigned long bytewidth)
+{
+	int v = 0;
+	memcpy(&v, p, bytewidth);
+	return _mm_cvtsi32_si128(v);
+}
+
+__attribute__((target("sse2")))
+static void store_pixel(unsigned char *p, __m128i x, unsigned long bytewidth)
+{
+	int v = _mm_cvtsi128_si32(x);
+	memcpy(p, &v, bytewidth);
+}
+
+__attribute__((target("sse2")))
+static void unfilter_up_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i;
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+
+__attribute__((target("avx2")))
+static void unfilter_up_avx2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i;
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(scanline + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(precon + i));
+		_mm256_storeu_si256((__m256i*)(recon + i), _mm256_add_epi8(x, b));
+	}
+	for (; i < length; i++)
+		recon[i] = scanline[i] + precon[i];
+}
+
+__attribute__((target("sse2")))
+static void unfilter_sub3_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	__m128i a = _mm_setzero_si128();
+	unsigned long i;
+	(void)precon;
+	for (i = 0; i < length; i += 3) {
+		a = _mm_add_epi8(a, load_pixel(scanline + i, 3));
+		store_pixel(recon + i, a, 3);
+	}
+}
+
+/* a running sum of pixels: adding each 16 bytes shifted by one and then two pixels sums the four in them, and the carry adds the last pixel before */
+__attribute__((target("sse2")))
+static void unfilter_sub4_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	__m128i carry = _mm_setzero_si128();
+	unsigned long i;
+	(void)precon;
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i*)(recon + i), x);
+		carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	for (; i < length; i += 4) {
+		carry = _mm_add_epi8(carry, load_pixel(scanline + i, 4));
+		store_pixel(recon + i, carry, 4);
+	}
+}
+
+/* _mm_avg_epu8 rounds up, so the low bit of a ^ b is taken back off for the floor of the average */
+__attribute__((target("sse2")))
+static void unfilter_average_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length, unsigned long bytewidth)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	unsigned long i;
+	for (i = 0; i < length; i += bytewidth) {
+		__m128i b = load_pixel(precon + i, bytewidth);
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(load_pixel(scanline + i, bytewidth), average);
+		store_pixel(recon + i, a, bytewidth);
+	}
+}
+
+__attribute__((target("sse2")))
+static void unfilter_average3_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_average_sse2(recon, scanline, precon, length, 3);
+}
+
+__attribute__((target("sse2")))
+static void unfilter_average4_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_average_sse2(recon, scanline, precon, length, 4);
+}
+
+__attribute__((target("sse2")))
+static __m128i abs_epi16_sse2(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+__attribute__((target("ssse3")))
+static __m128i abs_epi16_ssse3(__m128i x)
+{
+	return _mm_abs_epi16(x);
+}
+
+__attribute__((target("sse2")))
+static __m128i select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+   paeth_predictor() on 16-bit lanes: with p = a + b - c, |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |(b - c) + (a - c)|.
+   Ties go to a, then b, as in the scalar code. The SSE2 and SSSE3 versions only differ in how they take absolute values.
+*/
+#define DEFINE_UNFILTER_PAETH(name, isa, abs_epi16) \
+__attribute__((target(isa))) \
+static void name(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length, unsigned long bytewidth) \
+{ \
+	const __m128i zero = _mm_setzero_si128(); \
+	__m128i a = zero, c = zero; \
+	unsigned long i; \
+	for (i = 0; i < length; i += bytewidth) { \
+		__m128i b = _mm_unpacklo_epi8(load_pixel(precon + i, bytewidth), zero); \
+		__m128i pa = _mm_sub_epi16(b, c); \
+		__m128i pb = _mm_sub_epi16(a, c); \
+		__m128i pc = abs_epi16(_mm_add_epi16(pa, pb)); \
+		__m128i smallest, nearest, d; \
+		pa = abs_epi16(pa); \
+		pb = abs_epi16(pb); \
+		smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+		nearest = select_epi16(_mm_cmpeq_epi16(smallest, pb), b, c); \
+		nearest = select_epi16(_mm_cmpeq_epi16(smallest, pa), a, nearest); \
+		d = _mm_add_epi8(load_pixel(scanline + i, bytewidth), _mm_packus_epi16(nearest, nearest)); \
+		store_pixel(recon + i, d, bytewidth); \
+		a = _mm_unpacklo_epi8(d, zero); \
+		c = b; \
+	} \
+}
+
+DEFINE_UNFILTER_PAETH(unfilter_paeth_sse2, "sse2", abs_epi16_sse2)
+DEFINE_UNFILTER_PAETH(unfilter_paeth_ssse3, "ssse3", abs_epi16_ssse3)
+
+__attribute__((target("sse2")))
+static void unfilter_paeth3_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_paeth_sse2(recon, scanline, precon, length, 3);
+}
+
+__attribute__((target("sse2")))
+static void unfilter_paeth4_sse2(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_paeth_sse2(recon, scanline, precon, length, 4);
+}
+
+__attribute__((target("ssse3")))
+static void unfilter_paeth3_ssse3(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_paeth_ssse3(recon, scanline, precon, length, 3);
+}
+
+__attribute__((target("ssse3")))
+static void unfilter_paeth4_ssse3(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unfilter_paeth_ssse3(recon, scanline, precon, length, 4);
+}
+
+#endif
+
+/*pick the widest kernels the CPU runs for this pixel size; the ones left NULL fall back to unfilter_scanline()*/
+static void select_unfilter_kernels(unfilter_kernels* kernels, unsigned long bytewidth)
+{
+	memset(kernels, 0, sizeof(*kernels));
+
+#if defined(UPNG_X86_UNFILTER)
+	if (!__builtin_cpu_supports("sse2")) {
+		return;
+	}
+
+	kernels->up = __builtin_cpu_supports("avx2") ? unfilter_up_avx2 : unfilter_up_sse2;
+	if (bytewidth == 3) {
+		kernels->sub = unfilter_sub3_sse2;
+		kernels->average = unfilter_average3_sse2;
+		kernels->paeth = __builtin_cpu_supports("ssse3") ? unfilter_paeth3_ssse3 : unfilter_paeth3_sse2;
+	} else if (bytewidth == 4) {
+		kernels->sub = unfilter_sub4_sse2;
+		kernels->average = unfilter_average4_sse2;
+		kernels->paeth = __builtin_cpu_supports("ssse3") ? unfilter_paeth4_ssse3 : unfilter_paeth4_sse2;
+	}
+#else
+	(void)bytewidth;
+#endif
+}
+
+static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp, const unfilter_kernels* kernels)
 {
 	/*
 	   For PNG filter method 0
@@ -770,10 +1076,33 @@ static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in,
 		unsigned long outindex = linebytes * y;
 		unsigned long inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
 		unsigned char filterType = in[inindex];
+		unfilter_kernel kernel = NULL;
 
-		unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
-		if (upng->error != UPNG_EOK) {
-			return;
+		/* the first scanline has no previous one and is left to the scalar code */
+		if (prevline != 0) {
+			switch (filterType) {
+			case 1:
+				kernel = kernels->sub;
+				break;
+			case 2:
+				kernel = kernels->up;
+				break;
+			case 3:
+				kernel = kernels->average;
+				break;
+			case 4:
+				kernel = kernels->paeth;
+				break;
+			}
+		}
+
+		if (kernel != NULL) {
+			kernel(&out[outindex], &in[inindex + 1], prevline, linebytes);
+		} else {
+			unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
+			if (upng->error != UPNG_EOK) {
+				return;
+			}
 		}
 
 		prevline = &out[outindex];
@@ -813,20 +1142,23 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 	unsigned bpp = upng_get_bpp(info_png);
 	unsigned w = info_png->width;
 	unsigned h = info_png->height;
+	unfilter_kernels kernels;
 
 	if (bpp == 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
+	select_unfilter_kernels(&kernels, (bpp + 7) / 8);
+
 	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
-		unfilter(upng, in, in, w, h, bpp);
+		unfilter(upng, in, in, w, h, bpp, &kernels);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 		remove_padding_bits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
 	} else {
-		unfilter(upng, out, in, w, h, bpp);	/*we can immediatly filter into the out buffer, no other steps needed */
+		unfilter(upng, out, in, w, h, bpp, &kernels);	/*we can immediatly filter into the out buffer, no other steps needed */
 	}
 }
 
@@ -883,13 +1215,18 @@ static upng_format determine_format(upng_t* upng) {
 
 static void upng_free_source(upng_t* upng)
 {
-	if (upng->source.owning != 0) {
+	if (upng->source.owning == UPNG_SOURCE_HEAP) {
 		free((void*)upng->source.buffer);
 	}
+#if defined(UPNG_USE_MMAP)
+	else if (upng->source.owning == UPNG_SOURCE_MAPPED) {
+		munmap((void*)upng->source.buffer, upng->source.size);
+	}
+#endif
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_SOURCE_BORROWED;
 }
 
 /*read the information from the header and store it in the upng_Info. return value is error*/
@@ -956,19 +1293,26 @@ upng_error upng_header(upng_t* upng)
 		return upng->error;
 	}
 
+	/* bytes of the decoded image */
+	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+
 	upng->state = UPNG_HEADER;
 	return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/*size of the inflated, still filtered scanlines: each one starts with its filter type byte*/
+unsigned long upng_get_scratch_size(const upng_t* upng)
+{
+	return (unsigned long)upng->height * (1 + (upng->width * upng_get_bpp(upng) + 7) / 8);
+}
+
+/*read a PNG into out, which must hold upng_get_size() bytes. The scanlines are inflated into out itself when it has room for
+  upng_get_scratch_size() bytes, else into scratch, which must then be that large; only without either is a temporary allocated*/
+upng_error upng_decode_into(upng_t* upng, unsigned char* out, unsigned long outsize, unsigned char* scratch, unsigned long scratchsize)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
 	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
 	unsigned long inflated_size;
-	upng_error error;
 
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
@@ -986,21 +1330,19 @@ upng_error upng_decode(upng_t* upng)
 		return upng->error;
 	}
 
-	/* release old result, if any */
-	if (upng->buffer != 0) {
-		free(upng->buffer);
-		upng->buffer = 0;
-		upng->size = 0;
+	inflated_size = upng_get_scratch_size(upng);
+	if (out == NULL || outsize < upng->size || (scratch != NULL && outsize < inflated_size && scratchsize < inflated_size)) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return upng->error;
 	}
 
 	/* first byte of the first chunk after the header */
 	chunk = upng->source.buffer + 33;
 
-	/* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
+	/* scan through the chunks to verify general well-formed-ness; the inflater
+	 * then reads the IDAT payloads in place, walking the same chunks again */
 	while (chunk < upng->source.buffer + upng->source.size) {
 		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
 
 		/* make sure chunk header is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
@@ -1021,15 +1363,10 @@ upng_error upng_decode(upng_t* upng)
 			return upng->error;
 		}
 
-		/* get pointer to payload */
-		data = chunk + 8;
-
 		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			compressed_size += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+		if (upng_chunk_type(chunk) == CHUNK_IEND) {
 			break;
-		} else if (upng_chunk_critical(chunk)) {
+		} else if (upng_chunk_critical(chunk) && upng_chunk_type(chunk) != CHUNK_IDAT) {
 			SET_ERROR(upng, UPNG_EUNSUPPORTED);
 			return upng->error;
 		}
@@ -1037,79 +1374,80 @@ upng_error upng_decode(upng_t* upng)
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+	/* pick where to store inflated (but still filtered) data; unfiltering works in place */
+	if (outsize >= inflated_size) {
+		inflated = out;
+	} else if (scratch != NULL) {
+		inflated = scratch;
+	} else {
+		inflated = (unsigned char*)malloc(inflated_size);
+		if (inflated == NULL) {
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return upng->error;
+		}
 	}
 
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
+	/* decompress image data, then unfilter scanlines */
+	uz_inflate(upng, inflated, inflated_size, upng->source.buffer + 33, chunk);
+	if (upng->error == UPNG_EOK) {
+		post_process_scanlines(upng, out, inflated, upng);
+	}
 
-		length = upng_chunk_length(chunk);
-		data = chunk + 8;
+	if (inflated != out && inflated != scratch) {
+		free(inflated);
+	}
 
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
-		}
+	if (upng->error == UPNG_EOK) {
+		upng->state = UPNG_DECODED;
+	}
 
-		chunk += upng_chunk_length(chunk) + 12;
+	/* we are done with our input buffer; free it if we own it */
+	upng_free_source(upng);
+
+	return upng->error;
+}
+
+/*read a PNG into a buffer owned by upng, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+	unsigned long buffer_size;
+
+	/* if we have an error state, bail now */
+	if (upng->error != UPNG_EOK) {
+		return upng->error;
 	}
 
-	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
-	inflated = (unsigned char*)malloc(inflated_size);
-	if (inflated == NULL) {
-		free(compressed);
-		SET_ERROR(upng, UPNG_ENOMEM);
+	/* parse the main header, if necessary */
+	upng_header(upng);
+	if (upng->error != UPNG_EOK) {
 		return upng->error;
 	}
 
-	/* decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
-	if (error != UPNG_EOK) {
-		free(compressed);
-		free(inflated);
+	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
+	if (upng->state != UPNG_HEADER) {
 		return upng->error;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
+	/* release old result, if any */
+	if (upng->buffer != 0) {
+		free(upng->buffer);
+		upng->buffer = 0;
+	}
 
-	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
-	upng->buffer = (unsigned char*)malloc(upng->size);
+	/* allocate the final image buffer with room to inflate into it (the filter bytes make that never less than the image), so no other buffer is needed */
+	buffer_size = upng_get_scratch_size(upng);
+	upng->buffer = (unsigned char*)malloc(buffer_size);
 	if (upng->buffer == NULL) {
-		free(inflated);
-		upng->size = 0;
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng->error;
 	}
 
-	/* unfilter scanlines */
-	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	free(inflated);
-
+	upng_decode_into(upng, upng->buffer, buffer_size, NULL, 0);
 	if (upng->error != UPNG_EOK) {
 		free(upng->buffer);
 		upng->buffer = NULL;
-		upng->size = 0;
-	} else {
-		upng->state = UPNG_DECODED;
 	}
 
-	/* we are done with our input buffer; free it if we own it */
-	upng_free_source(upng);
-
 	return upng->error;
 }
 
@@ -1138,7 +1476,7 @@ static upng_t* upng_new(void)
 
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_SOURCE_BORROWED;
 
 	return upng;
 }
@@ -1152,11 +1490,47 @@ upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 
 	upng->source.buffer = buffer;
 	upng->source.size = size;
-	upng->source.owning = 0;
+	upng->source.owning = UPNG_SOURCE_BORROWED;
 
 	return upng;
 }
 
+#if defined(UPNG_USE_MMAP)
+/*map the file read-only as the source, hinting that it is read once from start to end; returns 0 when the caller should read it instead*/
+static int upng_map_file(upng_t* upng, const char *filename)
+{
+	struct stat info;
+	void *mapping;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	/* an empty file cannot be mapped, and a pipe or device cannot be sized */
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+
+	/* the mapping stays valid after the descriptor is closed */
+	mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return 0;
+	}
+
+	posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+	posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_WILLNEED);
+
+	upng->source.buffer = (const unsigned char*)mapping;
+	upng->source.size = (unsigned long)info.st_size;
+	upng->source.owning = UPNG_SOURCE_MAPPED;
+	return 1;
+}
+#endif
+
 upng_t* upng_new_from_file(const char *filename)
 {
 	upng_t* upng;
@@ -1169,6 +1543,12 @@ upng_t* upng_new_from_file(const char *filename)
 		return NULL;
 	}
 
+#if defined(UPNG_USE_MMAP)
+	if (upng_map_file(upng, filename)) {
+		return upng;
+	}
+#endif
+
 	file = fopen(filename, "rb");
 	if (file == NULL) {
 		SET_ERROR(upng, UPNG_ENOTFOUND);
@@ -1193,7 +1573,7 @@ upng_t* upng_new_from_file(const char *filename)
 	/* set the read buffer as our source buffer, with owning flag set */
 	upng->source.buffer = buffer;
 	upng->source.size = size;
-	upng->source.owning = 1;
+	upng->source.owning = UPNG_SOURCE_HEAP;
 
 	return upng;
 }
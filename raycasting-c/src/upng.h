@@ -63,6 +63,7 @@ void		upng_free			(upng_t* upng);
 
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+upng_error	upng_decode_into	(upng_t* upng, unsigned char* out, unsigned long outsize, unsigned char* scratch, unsigned long scratchsize);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
@@ -77,5 +78,6 @@ upng_format	upng_get_format		(const upng_t* upng);
 
 const unsigned char*	upng_get_buffer		(const upng_t* upng);
 unsigned				upng_get_size		(const upng_t* upng);
+unsigned long			upng_get_scratch_size	(const upng_t* upng);
 
 #endif /*defined(UPNG_H)*/
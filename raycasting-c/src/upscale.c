@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "upscale.h"
+
+// Source column of each destination column, rebuilt when the widths change.
+static int* sourceColumns = NULL;
+static int sourceColumnsSrcWidth = 0;
+static int sourceColumnsDstWidth = 0;
+
+static bool buildSourceColumns(int srcWidth, int dstWidth)
+{
+	if (sourceColumns && sourceColumnsSrcWidth == srcWidth && sourceColumnsDstWidth == dstWidth)
+		return true;
+	free(sourceColumns);
+	sourceColumns = (int*)malloc(sizeof(int) * dstWidth);
+	if (!sourceColumns)
+	{
+		sourceColumnsSrcWidth = sourceColumnsDstWidth = 0;
+		return false;
+	}
+	for (int x = 0; x < dstWidth; x++)
+		sourceColumns[x] = (int)((long long)x * srcWidth / dstWidth);
+	sourceColumnsSrcWidth = srcWidth;
+	sourceColumnsDstWidth = dstWidth;
+	return true;
+}
+
+static void scaleRow(const color_t* src, int srcWidth, color_t* dst, int dstWidth)
+{
+	int x = 0;
+	if (dstWidth == srcWidth)
+	{
+		memcpy(dst, src, sizeof(color_t) * dstWidth);
+		return;
+	}
+#ifdef __SSE2__
+	if (dstWidth == srcWidth * 2)
+	{
+		for (; x + 4 <= srcWidth; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(src + x));
+			_mm_storeu_si128((__m128i*)(dst + 2 * x), _mm_unpacklo_epi32(pixels, pixels));
+			_mm_storeu_si128((__m128i*)(dst + 2 * x + 4), _mm_unpackhi_epi32(pixels, pixels));
+		}
+		for (; x < srcWidth; x++)
+			dst[2 * x] = dst[2 * x + 1] = src[x];
+		return;
+	}
+	if (dstWidth == srcWidth * 4)
+	{
+		for (; x + 4 <= srcWidth; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(src + x));
+			_mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_shuffle_epi32(pixels, 0x00));
+			_mm_storeu_si128((__m128i*)(dst + 4 * x + 4), _mm_shuffle_epi32(pixels, 0x55));
+			_mm_storeu_si128((__m128i*)(dst + 4 * x + 8), _mm_shuffle_epi32(pixels, 0xAA));
+			_mm_storeu_si128((__m128i*)(dst + 4 * x + 12), _mm_shuffle_epi32(pixels, 0xFF));
+		}
+		for (; x < srcWidth; x++)
+			dst[4 * x] = dst[4 * x + 1] = dst[4 * x + 2] = dst[4 * x + 3] = src[x];
+		return;
+	}
+#endif
+	for (; x < dstWidth; x++)
+		dst[x] = src[sourceColumns[x]];
+}
+
+void upscaleNearest(const color_t* src, int srcWidth, int srcHeight, int srcPitch,
+	color_t* dst, int dstWidth, int dstHeight, int dstPitch)
+{
+	if (!buildSourceColumns(srcWidth, dstWidth))
+		return;
+	int lastSrcY = -1;
+	for (int y = 0; y < dstHeight; y++)
+	{
+		int srcY = (int)((long long)y * srcHeight / dstHeight);
+		color_t* dstRow = dst + (size_t)y * dstPitch;
+		// consecutive rows from the same source row are copies of the one just scaled
+		if (srcY == lastSrcY)
+			memcpy(dstRow, dstRow - dstPitch, sizeof(color_t) * dstWidth);
+		else
+			scaleRow(src + (size_t)srcY * srcPitch, srcWidth, dstRow, dstWidth);
+		lastSrcY = srcY;
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef UPSCALE_H
+#define UPSCALE_H
+
+#include "defs.h"
+
+// Nearest-neighbour scale of a srcWidth x srcHeight image into dstWidth x dstHeight;
+// pitches are in pixels. Integer horizontal factors of 2 and 4 use SSE2.
+void upscaleNearest(const color_t* src, int srcWidth, int srcHeight, int srcPitch,
+	color_t* dst, int dstWidth, int dstHeight, int dstPitch);
+
+#endif
@@ -1,63 +1,91 @@
 #include "wall.h"
 
-void changeColorIntensity(color_t* color, float factor)
-{
-	color_t a = (*color & 0xFF000000);
-	color_t r = (*color & 0x00FF0000) * factor;
-	color_t g = (*color & 0x0000FF00) * factor;
-	color_t b = (*color & 0x000000FF) * factor;
-
-	*color = a | (r & 0x00FF0000) | (g & 0x0000FF00) | (b & 0x000000FF);
-}
+// Tall enough to show a single texel on any screen, small enough that the strip math stays in an int.
+#define MAX_WALL_STRIP_HEIGHT (1 << 24)
 
-void renderWallProjection(void)
+// Draws ceiling, wall strip and floor of the columns [begin, end); a band only
+// writes its own framebuffer columns, so bands run on the thread pool.
+static void renderWallBand(void* context, int begin, int end)
 {
-	for (int x = 0; x < NUM_RAYS; x++)
+	(void)context;
+	for (int x = begin; x < end; x++)
 	{
 		//↓Maintain a constant angle of the field of view you are looking at. (Eliminate the roundness of the wall)
-		float perpDistance = rays[x].distance * cos(rays[x].rayAngle - player.rotationAngle);
+		float perpDistance = getRayDistance(x) * camera.columnCos[x];
 		//↓Scaling up the distance of one lattice to one tile to the screen size.
-		float projectedWallHeight = (TILE_SIZE / perpDistance) * DIST_PROJ_PLANE;
+		float projectedWallHeight = camera.wallHeightScale / perpDistance;
 
+		// a degenerate projection (zero distance or plane) gives inf or NaN; strips taller than the
+		// screen keep their height, which the texture step below is taken from
+		if (!(projectedWallHeight > 0))
+			projectedWallHeight = 0;
+		if (projectedWallHeight > MAX_WALL_STRIP_HEIGHT)
+			projectedWallHeight = MAX_WALL_STRIP_HEIGHT;
 		int wallStripHeight = (int)projectedWallHeight;
 
-		int wallTopPixel = (WINDOW_HEIGHT / 2) - (wallStripHeight / 2);
-		wallTopPixel = wallTopPixel < 0 ? 0 : wallTopPixel;
+		int wallTopPixel = (camera.numRows / 2) - (wallStripHeight / 2);
+		wallTopPixel = wallTopPixel < 0 ? 0 : wallTopPixel > camera.numRows ? camera.numRows : wallTopPixel;
+
+		int wallBottomPixel = (camera.numRows / 2) + (wallStripHeight / 2);
+		wallBottomPixel = wallBottomPixel < 0 ? 0 : wallBottomPixel > camera.numRows ? camera.numRows : wallBottomPixel;
 
-		int wallBottomPixel = (WINDOW_HEIGHT / 2) + (wallStripHeight / 2);
-		wallBottomPixel = wallBottomPixel > WINDOW_HEIGHT ? WINDOW_HEIGHT : wallBottomPixel;
+		// write straight down the framebuffer column, whichever layout it has
+		int pixelStride;
+		color_t* pixelColumn = getFramebufferColumn(x, &pixelStride);
+
+		// rows above firstRow belong to the minimap overlay, which draws them itself
+		int firstRow = getOverlayBottom(x);
+		int wallFirstRow = wallTopPixel > firstRow ? wallTopPixel : firstRow;
+		int floorFirstRow = wallBottomPixel > firstRow ? wallBottomPixel : firstRow;
 
 		// set the color of the ceiling
-		for (int y = 0; y < wallTopPixel; y++)
-			drawPixel(x, y, 0xFF444444);
+		for (int y = firstRow; y < wallTopPixel; y++)
+			pixelColumn[y * pixelStride] = 0xFF444444;
 
-		// calculate textureOffsetX
-		int textureOffsetX;
-		if(rays[x].wasHitVertical)
-		{
-			textureOffsetX = (int)rays[x].wallHitY % TILE_SIZE;
-		} else {
-			textureOffsetX = (int)rays[x].wallHitX % TILE_SIZE;
-		}
+		// side and distance shading is one shade index per column
+		int shade = getWallShade(perpDistance, getRayWasHitVertical(x));
+
+		int texNum = getRayWallHitContent(x) - 1;
 
-		int texNum = rays[x].wallHitContent - 1;
+		// short (distant) strips sample a smaller mip level
+		int mipLevel = selectMipLevel(&wallTextures[texNum], wallStripHeight);
+		int texture_width = wallTextures[texNum].mips[mipLevel].width;
+		int texture_height = wallTextures[texNum].mips[mipLevel].height;
+		int textureOffsetX = getRayWallHitOffset(x) * texture_width / TILE_SIZE;
 
-		int texture_width = wallTextures[texNum].width;
-		int texture_height = wallTextures[texNum].height;
+		// a baked shade is just another texture buffer; otherwise shade each texel through the LUT
+		bool bakedShade = shade < wallTextures[texNum].numShades;
+		int texelStride;
+		const color_t* texelColumn = getTextureColumn(&wallTextures[texNum], mipLevel, bakedShade ? shade : 0, textureOffsetX, &texelStride);
 		// render the wall from wallTopPixel to wallBottomPixel
-		for (int y = wallTopPixel; y < wallBottomPixel; y++)
+		if (bakedShade || shade == 0)
 		{
-			int distanceFromTop = y + (wallStripHeight / 2) - (WINDOW_HEIGHT / 2);
-			//Extend and retract the height
-			int textureOffsetY = distanceFromTop * ((float)texture_height / wallStripHeight);
-
-			color_t texelColor = wallTextures[texNum].texture_buffer[(texture_width * textureOffsetY) + textureOffsetX];
-			if(rays[x].wasHitVertical)
-				changeColorIntensity(&texelColor, 0.7);
-			drawPixel(x, y, texelColor);
+			for (int y = wallFirstRow; y < wallBottomPixel; y++)
+			{
+				int distanceFromTop = y + (wallStripHeight / 2) - (camera.numRows / 2);
+				//Extend and retract the height
+				int textureOffsetY = distanceFromTop * ((float)texture_height / wallStripHeight);
+
+				pixelColumn[y * pixelStride] = texelColumn[textureOffsetY * texelStride];
+			}
+		}
+		else
+		{
+			for (int y = wallFirstRow; y < wallBottomPixel; y++)
+			{
+				int distanceFromTop = y + (wallStripHeight / 2) - (camera.numRows / 2);
+				int textureOffsetY = distanceFromTop * ((float)texture_height / wallStripHeight);
+
+				pixelColumn[y * pixelStride] = shadeColor(texelColumn[textureOffsetY * texelStride], shade);
+			}
 		}
 		// set the color of the floor
-		for (int y = wallBottomPixel; y < WINDOW_HEIGHT; y++)
-			drawPixel(x, y, 0XFF888888);
-	};
-}
\ No newline at end of file
+		for (int y = floorFirstRow; y < camera.numRows; y++)
+			pixelColumn[y * pixelStride] = 0XFF888888;
+	}
+}
+
+void renderWallProjection(void)
+{
+	parallelFor(camera.numColumns, renderWallBand, NULL);
+}
@@ -4,9 +4,12 @@
 #include <math.h>
 #include "defs.h"
 #include "player.h"
+#include "camera.h"
 #include "ray.h"
 #include "graphics.h"
+#include "shading.h"
 #include "textures.h"
+#include "threadpool.h"
 
 void renderWallProjection(void);
 